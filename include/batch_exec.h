@@ -0,0 +1,120 @@
+/**
+ * @file batch_exec.h - Vectorized executor: filters and projections over ColumnBatches.
+ * BatchPredicate, BatchExecutor
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "column_batch.h"
+#include "eval_operator.h"
+#include "simd_filter.h"
+
+/**
+ * @class BatchPredicate - one comparison of a batch column against a constant
+ */
+class BatchPredicate {
+  public:
+    typedef IntFilter::Op Op;
+
+    BatchPredicate(uint column, Op op, const Value &value) : column(column), op(op), value(value) {}
+
+    virtual ~BatchPredicate() {}
+
+    // is it on an INT or BOOLEAN column (so it can run as an IntFilter kernel)?
+    bool is_int() const { return value.data_type != ColumnAttribute::TEXT; }
+
+    /**
+     * Narrow the batch's selection to the rows that satisfy this (TEXT) predicate.
+     * The column must be of the same type as the constant.
+     * @param batch  batch to filter
+     */
+    void apply(ColumnBatch &batch) const;
+
+    /**
+     * Clear the mask bits of the batch's rows that don't satisfy this (INT or BOOLEAN) predicate.
+     * @param batch  batch to filter
+     * @param mask   one bit per row of the batch, as for IntFilter
+     */
+    void apply(const ColumnBatch &batch, uint64_t *mask) const;
+
+  protected:
+    uint column;  // which column of the batch
+    Op op;
+    Value value;
+};
+
+/**
+ * @class BatchExecutor - a table scan with its select and project, run a
+ * ColumnBatch at a time
+ *
+ * The predicates run as tight loops over each batch's columns: those on INT
+ * and BOOLEAN columns as IntFilter kernels ANDed into a bitmask, then those on
+ * TEXT columns narrowing the selection vector the mask turns into. Only the
+ * rows that make it through are turned into Rows. This is an
+ * alternative to ScanProjectOperator for relations that support batches().
+ */
+class BatchExecutor : public RowOperator {
+  public:
+    /**
+     * Make a batch executor for the given scan, if the table supports it.
+     * @param table       table to scan
+     * @param projection  columns of the result rows
+     * @param where       equality predicates (may be nullptr)
+     * @param ranges      range predicates (may be nullptr)
+     * @param arena       where to keep the result rows' values (the heap if nullptr)
+     * @returns           the executor (freed by caller), or nullptr if the table can't do batches
+     */
+    static BatchExecutor *create(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                                 const ValueRanges *ranges, QueryArena *arena = nullptr);
+
+    // a copy has the same scan and predicates, but is not open
+    BatchExecutor(const BatchExecutor &other);
+
+    BatchExecutor &operator=(const BatchExecutor &other) = delete;
+
+    virtual ~BatchExecutor();
+
+    /**
+     * Limit the scan to one morsel of the table (from the next open()).
+     * @param morsel             which morsel
+     * @param blocks_per_morsel  blocks in each morsel, or 0 to scan the whole table
+     */
+    void set_morsel(uint morsel, uint blocks_per_morsel) {
+        this->morsel = morsel;
+        this->blocks_per_morsel = blocks_per_morsel;
+    }
+
+    virtual void open();
+
+    virtual bool next(Row *&row);
+
+    virtual void close();
+
+  protected:
+    DbRelation &table;
+    ColumnNames projection;
+    std::vector<uint> projection_columns;  // batch column of each projected column
+    ColumnNames batch_columns;              // every column we need, each once
+    std::vector<BatchPredicate> predicates;  // INT and BOOLEAN ones first
+    uint int_predicates;                    // how many of those there are
+    uint64_t mask[ColumnBatch::CAPACITY / 64];
+    bool none;                              // predicates can't all be true (type mismatch)
+    uint morsel;
+    uint blocks_per_morsel;                 // 0 for the whole table
+    ColumnBatch *batch;
+    BatchScan *scan;
+    uint cursor;
+    QueryArena *arena;
+
+    BatchExecutor(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                  const ValueRanges *ranges, QueryArena *arena);
+
+    uint batch_column(const Identifier &column_name);
+
+    void add_predicate(const BatchPredicate &predicate);
+
+    void add_bound(const Identifier &column_name, BatchPredicate::Op op, const Value &bound,
+                   const ValueRange &range);
+};
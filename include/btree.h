@@ -6,16 +6,44 @@
  */
 #pragma once
 
+#include <functional>
 #include "btree_node.h"
 
+class BTreeEntrySorter;
+
 class BTreeIndex : public DbIndex {
 public:
+    static const u_long DEFAULT_SORT_RUN = 1000 * 1000;  // entries create() sorts in memory at once
+
+    // A non-unique index keeps each entry under its key followed by its handle, so equal keys are kept in handle
+    // order and a lookup is a scan of all the entries that begin with the key.
     BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
 
+    /**
+     * Make the B-tree index that suits the key: a BTreeFixedIndex, with keys packed into fixed-width slots, for a
+     * unique index on a single INT or BOOLEAN column, otherwise a BTreeIndex.
+     * @return  the index (freed by caller)
+     */
+    static BTreeIndex *make(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
     virtual ~BTreeIndex();
 
+    // Build the index from the rows already in the relation, bottom-up.
     virtual void create();
 
+    /**
+     * How full (in percent) create() makes each block, leaving room for later inserts. This is also how much of
+     * a node is kept when it splits at the right edge of the tree (as keys that only grow make it do). It is set
+     * for good when the index is created and kept in the index's stat block.
+     * @param fill_factor  10 to 100
+     */
+    void set_fill_factor(uint fill_factor);
+
+    uint get_fill_factor() const { return this->fill_factor; }
+
+    // Most entries create() holds in memory; more than this are sorted in runs spilled to temporary files.
+    void set_sort_run(u_long sort_run) { this->sort_run = sort_run; }
+
     virtual void drop();
 
     virtual void open();
@@ -26,9 +54,13 @@ public:
 
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
-    virtual void insert(Handle handle);
+    using DbIndex::insert;
 
-    virtual void del(Handle handle);
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    using DbIndex::del;
+
+    virtual void del(Handle handle, const ValueDict *row);
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
@@ -39,12 +71,47 @@ protected:
     BTreeNode *root;
     HeapFile file;
     KeyProfile key_profile;
+    uint fill_factor;
+    u_long sort_run;
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    // Project the key of every row in the relation and pass it (to be taken if wanted) and its handle to add.
+    void for_each_key(std::function<void(KeyValue &key, Handle handle)> add);
+
+    // Read the root node given in the stat block (open() has just read the stat block).
+    virtual void read_root();
+
+    // whether nodes kept in the given key format are from before this class's, and must be rebuilt to be read
+    virtual bool outdated(uint key_format) const { return key_format == BTreeStat::LEGACY_KEYS; }
+
+    // replace the outdated index open() found with a fresh create() from the relation
+    void rebuild();
+
+    void build(BTreeEntrySorter &sorter);
+
+    typedef std::vector<std::pair<std::string, BlockID>> Level;  // the boundary before and block of each node of a level
+
+    Level build_interior_level(const Level &below);
+
+    friend bool test_btree();
+
+    friend bool test_btree_fixed();
+
+    // the normalized key columns of key
+    std::string normalized(const ValueDict *key) const;
+
+    // what an entry is kept under: the normalized key, then (in a non-unique index) its handle
+    std::string entry_key(const KeyValue *key, Handle handle) const;
+
+    // handles of the entries from min_key to max_key (inclusive, either null for an open end), in order
+    Handles *scan(const std::string *min_key, const std::string *max_key) const;
+
+    Handles *_lookup(BTreeNode *node, uint height, const std::string &key) const;
+
+    Insertion _insert(BTreeNode *node, uint height, const std::string &key, Handle handle, bool rightmost);
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    bool _del(BTreeNode *node, uint height, const std::string &key, Handle handle);
 };
 
 bool test_btree();
@@ -0,0 +1,205 @@
+/**
+ * @file btree_fixed.h - B-tree index specialized for a single fixed-width key column.
+ * BTreeFixedNode, BTreeFixedLeaf, BTreeFixedInterior, BTreeFixedIndex
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "btree.h"
+
+/**
+ * @class BTreeFixedNode - B-tree node whose block holds one record: a small
+ * header followed by arrays of fixed-width slots
+ *
+ * Keys are packed side by side in a sorted array of K, so a node holds about
+ * twice the entries of a BTreeLeaf or BTreeInterior of INT keys (which pay a
+ * length, a record header, and a separate record for the handle or pointer).
+ * The array is searched by a binary search whose compares select rather than
+ * branch.
+ *
+ * @tparam K  the key type: int32_t for an INT column, uint8_t for a BOOLEAN one
+ */
+template<typename K>
+class BTreeFixedNode : public BTreeNode {
+public:
+    BTreeFixedNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeFixedNode() {}
+
+    // number of keys
+    uint size() const { return header()->count; }
+
+protected:
+    // The record fills the block after the page header and its one record header, starting 4-byte aligned.
+    static const u_int16_t RECORD_SZ = DbBlock::BLOCK_SZ - 12;
+    static const uint HEADER_SZ = 8;
+
+    struct Header {
+        uint16_t count;
+        uint16_t unused;
+        BlockID link;  // next leaf, or first child
+    };
+
+    char *record;  // in the block
+
+    Header *header() const { return (Header *) this->record; }
+
+    K *keys() const { return (K *) (this->record + HEADER_SZ); }
+
+    // index of the first of keys[0..n) not before key (after key, if upper)
+    static uint search(const K *keys, uint n, K key, bool upper);
+};
+
+/**
+ * @class BTreeFixedLeaf - leaf of a BTreeFixedIndex: the keys, then the 6-byte
+ * handle of each, and the next leaf's block id in the header
+ */
+template<typename K>
+class BTreeFixedLeaf : public BTreeFixedNode<K> {
+public:
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+    static const uint CAPACITY = (BTreeFixedNode<K>::RECORD_SZ - BTreeFixedNode<K>::HEADER_SZ) / (sizeof(K) + HANDLE_SZ);
+
+    typedef std::pair<BlockID, K> Split;  // the new node and its first key after a split (block 0 if none)
+
+    BTreeFixedLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeFixedLeaf() {}
+
+    bool find_eq(K key, Handle &handle) const;
+
+    bool find_range(const K *min_key, const K *max_key, Handles *handles) const;
+
+    Split insert(K key, Handle handle, uint fill_factor);
+
+    bool del(K key, Handle handle);  // throws if not found
+
+    bool absorb(BTreeFixedLeaf *right);
+
+    // add an entry whose key is after all the others (for building a tree bottom-up)
+    void append(K key, Handle handle);
+
+    BlockID get_next_leaf() const { return this->header()->link; }
+
+    void set_next_leaf(BlockID next_leaf) { this->header()->link = next_leaf; }
+
+    BTreeFixedLeaf *next() const;
+
+protected:
+    char *handle_slot(uint i) const {
+        return this->record + BTreeFixedNode<K>::HEADER_SZ + CAPACITY * sizeof(K) + i * HANDLE_SZ;
+    }
+
+    Handle handle_at(uint i) const;
+
+    void put_handle(uint i, Handle handle);
+
+    void insert_at(uint i, K key, Handle handle);
+};
+
+/**
+ * @class BTreeFixedInterior - interior node of a BTreeFixedIndex: the
+ * boundaries, then the pointer to the right of each, with the first pointer in
+ * the header
+ */
+template<typename K>
+class BTreeFixedInterior : public BTreeFixedNode<K> {
+public:
+    static const uint CAPACITY =
+            (BTreeFixedNode<K>::RECORD_SZ - BTreeFixedNode<K>::HEADER_SZ - 3) / (sizeof(K) + sizeof(BlockID));
+
+    typedef std::pair<BlockID, K> Split;
+
+    BTreeFixedInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeFixedInterior() {}
+
+    // child where key must be (null for the leftmost): at depth 2, a leaf (freed by caller), else an interior node
+    // from BTreeNodeCache (not to be freed)
+    BTreeNode *find(const K *key, uint depth) const;
+
+    Split insert(K boundary, BlockID block_id, bool rightmost, uint fill_factor);
+
+    void merge_leaf(BTreeFixedLeaf<K> *leaf);
+
+    // add a boundary and pointer after all the others (for building a tree bottom-up)
+    void append(K boundary, BlockID block_id);
+
+    void set_first(BlockID first) { this->header()->link = first; }
+
+    BlockID get_first() const { return this->header()->link; }
+
+    BlockID get_last() const { return child(this->size()); }
+
+    bool is_pass_through() const { return this->size() == 0; }
+
+protected:
+    // after the keys, rounded up to a multiple of 4
+    BlockID *pointers() const {
+        return (BlockID *) (this->record + (BTreeFixedNode<K>::HEADER_SZ + CAPACITY * sizeof(K) + 3) / 4 * 4);
+    }
+
+    // pointer to the left of boundary i (the one to the right of all of them for i == size())
+    BlockID child(uint i) const { return i == 0 ? get_first() : pointers()[i - 1]; }
+};
+
+/**
+ * @class BTreeFixedIndex - unique B-tree index on one INT or BOOLEAN column,
+ * built of BTreeFixedLeaf and BTreeFixedInterior nodes
+ *
+ * Keys are handled as K throughout rather than as a KeyValue. Otherwise this
+ * works as BTreeIndex does: create() builds bottom-up to the fill factor,
+ * nodes at the right edge split by the fill factor, underflowing leaves merge,
+ * and the interior nodes come from the BTreeNodeCache. Made by
+ * BTreeIndex::make for keys that fit; its stat block is marked FIXED_KEYS, and
+ * open() rebuilds an index on the same key that isn't.
+ */
+template<typename K>
+class BTreeFixedIndex : public BTreeIndex {
+public:
+    BTreeFixedIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~BTreeFixedIndex() {}
+
+    virtual void create();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+
+    using DbIndex::insert;
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    using DbIndex::del;
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+protected:
+    typedef BTreeFixedLeaf<K> Leaf;
+    typedef BTreeFixedInterior<K> Interior;
+    typedef std::pair<BlockID, K> Split;
+    typedef std::vector<std::pair<K, BlockID>> FixedLevel;  // the first key and block of each node of a level
+
+    K fixed_key(const ValueDict *key) const;
+
+    virtual void read_root();
+
+    // an index on this key from before BTreeIndex::make chose fixed-width nodes has BTreeLeaf and BTreeInterior ones
+    virtual bool outdated(uint key_format) const { return key_format != BTreeStat::FIXED_KEYS; }
+
+    void build(const std::vector<std::pair<K, Handle>> &entries);
+
+    FixedLevel build_fixed_level(const FixedLevel &below);
+
+    // the leaf where key would be (null for the leftmost), freed by caller unless it's the root
+    Leaf *find_leaf(const K *key) const;
+
+    Split insert_below(BTreeNode *node, uint height, K key, Handle handle, bool rightmost);
+
+    bool del_below(BTreeNode *node, uint height, K key, Handle handle);
+};
+
+bool test_btree_fixed();
@@ -6,6 +6,7 @@
  */
 #pragma once
 
+#include <list>
 #include "storage_engine.h"
 #include "heap_storage.h"
 
@@ -13,7 +14,7 @@ typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<Value> KeyValue;
 typedef std::vector<KeyValue *> KeyValues;
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::pair<BlockID, std::string> Insertion;  // new node from a split and its (normalized) boundary
 
 class BTreeNode {
 public:
@@ -23,12 +24,15 @@ public:
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
 
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, std::string()); }
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    // key as the bytes kept in the block, which memcmp orders as the key is ordered
+    static std::string normalize_key(const KeyProfile &key_profile, const KeyValue *key);
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -39,21 +43,32 @@ protected:
 
     static Dbt *marshal_handle(Handle handle);
 
-    virtual Dbt *marshal_key(const KeyValue *key);
-
     virtual BlockID get_block_id(RecordID record_id) const;
 
     virtual Handle get_handle(RecordID record_id) const;
 
-    virtual KeyValue *get_key(RecordID record_id) const;
+    // compare a normalized key with the key in record_id, in place: negative, zero, or positive as key is before,
+    // equal to, or after it
+    int compare(const std::string &key, RecordID record_id) const;
+
+    // index of the first of the n keys kept in records 2, 4, 6, ... that is not before the normalized key (or is
+    // after it, if upper), found by binary search in the block
+    uint lower_bound(const std::string &key, uint n, bool upper = false) const;
 };
 
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID FILL_FACTOR = HEIGHT + 1;  // where we store the fill factor in the stat block
+    static const uint DEFAULT_FILL_FACTOR = 90;  // for indices whose stat block predates it
+    static const RecordID KEY_FORMAT = FILL_FACTOR + 1;  // where we store how the nodes hold their keys
+    static const uint LEGACY_KEYS = 0;  // BTreeLeaf and BTreeInterior with keys marshaled column by column as is
+    static const uint FIXED_KEYS = 1;  // BTreeFixedLeaf and BTreeFixedInterior
+    static const uint NORMALIZED_KEYS = 2;  // BTreeLeaf and BTreeInterior with memcmp-ordered keys
 
-    BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile);
+    BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile,
+              uint fill_factor = DEFAULT_FILL_FACTOR);
 
     BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile);
 
@@ -69,48 +84,213 @@ public:
 
     void set_height(uint height) { this->height = height; }
 
+    // percent of a block kept in the left node when a node at the right edge splits (and filled by a bulk load)
+    uint get_fill_factor() const { return this->fill_factor; }
+
+    uint get_key_format() const { return this->key_format; }
+
+    void set_key_format(uint key_format) { this->key_format = key_format; }
+
 protected:
     BlockID root_id;
     uint height;
+    uint fill_factor;
+    uint key_format;
 
 };
 
+class BTreeLeaf;
+
+/**
+ * @class BTreeInterior - interior node of a BTreeIndex, kept sorted in its block
+ *
+ * Record 1 is the first pointer, then each boundary and the pointer to its right
+ * take the next two records (boundary i in record 2i + 2, its pointer in 2i + 3).
+ * Nothing is decoded up front: find binary-searches the boundaries in the block
+ * and insert slides the later records up to make room. Boundaries are
+ * normalized keys, often cut short by BTreeLeaf::insert, so they are only
+ * ever compared, never turned back into a KeyValue.
+ */
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
-    virtual ~BTreeInterior();
+    virtual ~BTreeInterior() {}
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    // child where the normalized key must be: at depth 2, a leaf (freed by caller), else an interior node from
+    // BTreeNodeCache (not to be freed)
+    BTreeNode *find(const std::string *key, uint depth) const;
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    Insertion insert(const std::string &boundary, BlockID block_id, bool rightmost = false, uint fill_factor = 50);
 
-    virtual void save();
+    void merge_leaf(BTreeLeaf *leaf);
+
+    void set_first(BlockID first);
 
-    void set_first(BlockID first) { this->first = first; }
+    // add a boundary and pointer after all the others (for building a tree bottom-up)
+    void append(const std::string &boundary, BlockID block_id);
+
+    BlockID get_first() const { return this->first; }
+
+    BlockID get_last() const { return get_block_id(this->block->last_id()); }
+
+    bool is_pass_through() const { return this->block->last_id() == 1; }
 
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
     BlockID first;
-    BlockPointers pointers;
-    KeyValues boundaries;
+
+    // number of boundaries
+    uint size() const { return (this->block->last_id() - 1U) / 2; }
 };
 
+/**
+ * @class BTreeLeaf - leaf node of a BTreeIndex, kept sorted in its block
+ *
+ * Entry i takes two records: its handle in record 2i + 1 and its key in 2i + 2.
+ * The last record is the next leaf's block id followed by the prefix that all
+ * the leaf's keys share, which is taken off the front of each key record (so a
+ * leaf of URLs doesn't store "http://www." over and over). The prefix is only
+ * recomputed when the entries are laid out again by a split, a merge, or an
+ * insert that doesn't share it. As with BTreeInterior, the keys are searched
+ * where they sit in the block.
+ */
+typedef std::pair<Handle, std::string> LeafEntry;  // a handle and its full normalized key
+typedef std::vector<LeafEntry> LeafEntries;
+
 class BTreeLeaf : public BTreeNode {
 public:
+    static const u_long MAX_KEY_SZ = DbBlock::BLOCK_SZ / 2;  // longest normalized key
+
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
-    virtual ~BTreeLeaf();
+    virtual ~BTreeLeaf() {}
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    // The keys here are all normalized (see BTreeNode::normalize_key).
 
-    virtual void save();
+    Handle find_eq(const std::string &key) const;  // throws if not found
+
+    bool find_range(const std::string *min_key, const std::string *max_key, Handles *handles) const;
+
+    Insertion insert(const std::string &key, Handle handle, uint fill_factor = 50);
+
+    bool del(const std::string &key, Handle handle);  // throws if not found
+
+    bool absorb(BTreeLeaf *right);
+
+    BlockID get_next_leaf() const { return this->next_leaf; }
+
+    BTreeLeaf *next() const;
+
+    void set_next_leaf(BlockID next_leaf);
+
+    // replace the entries with entries[from..to), which must fit (for building a tree bottom-up, and for splits)
+    void put_entries(const LeafEntries &entries, u_long from, u_long to);
+
+    // bytes of a block that entries[from..to) would take as a leaf, page and record headers included
+    static u_long bytes_needed(const LeafEntries &entries, u_long from, u_long to);
+
+    // shortest boundary that sorts after left and not after right (right's bytes up to where they first differ)
+    static std::string separator(const std::string &left, const std::string &right);
 
 protected:
     BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    std::string prefix;
+
+    // number of entries
+    uint size() const { return (this->block->last_id() - 1U) / 2; }
+
+    uint bound(const std::string &key, bool upper = false) const;
+
+    std::string key_at(uint i) const;
+
+    void get_entries(LeafEntries &entries) const;
+
+    void put_trailer();
+
+    // put a marshaled handle and key suffix in as entry i
+    void insert_entry(uint i, const Dbt &handle, const Dbt &key);
 };
 
+/**
+ * @class BTreeNodeCache - the interior nodes of the B-tree indices most recently descended through
+ *
+ * A cached node keeps its block pinned in the buffer pool. Nodes read their
+ * entries in place from the block, so one stays current through the index's
+ * inserts, deletes and splits; the index only has to forget a node when it
+ * becomes the root (which the index holds itself) or the index is closed.
+ * Nodes are handed out still owned by the cache and are only evicted, least
+ * recently used first, by trim(), which the index calls when it is done with
+ * an operation. Like the indices, this is for one thread at a time.
+ */
+class BTreeNodeCache {
+public:
+    static const uint DEFAULT_CAPACITY = 64;
+
+    /**
+     * The node cache shared by all the indices.
+     * @return the cache
+     */
+    static BTreeNodeCache &instance();
+
+    BTreeNodeCache(uint capacity = DEFAULT_CAPACITY);
+
+    virtual ~BTreeNodeCache();
+
+    BTreeNodeCache(const BTreeNodeCache &other) = delete;
+
+    BTreeNodeCache &operator=(const BTreeNodeCache &other) = delete;
 
+    /**
+     * Get an interior node, reading it if it isn't cached.
+     * @tparam Node        the index's interior node class (BTreeInterior or a BTreeFixedInterior)
+     * @param file         the index's file
+     * @param block_id     the node's block
+     * @param key_profile  the index's key profile (must outlast the node, so forget the file first)
+     * @return             the node (still owned by the cache)
+     */
+    template<class Node>
+    Node *get(HeapFile &file, BlockID block_id, const KeyProfile &key_profile) {
+        BTreeNode *node = find(file, block_id);
+        if (node == nullptr) {
+            node = new Node(file, block_id, key_profile, false);
+            add(file, node);
+        }
+        return static_cast<Node *>(node);
+    }
+
+    virtual void forget(HeapFile &file, BlockID block_id);
+
+    // forget all of one index's nodes
+    virtual void forget(HeapFile &file);
+
+    // evict the least recently used nodes past capacity
+    virtual void trim();
+
+    uint get_capacity() const { return this->capacity; }
+
+    void set_capacity(uint capacity);
+
+    uint size() const { return (uint) this->cached.size(); }
+
+    unsigned long get_hits() const { return this->hits; }
+
+    unsigned long get_misses() const { return this->misses; }
+
+    void reset_counters() { this->hits = this->misses = 0; }
+
+protected:
+    typedef std::pair<HeapFile *, BlockID> NodeKey;
+    typedef std::list<std::pair<NodeKey, BTreeNode *>> Recency;
+
+    uint capacity;
+    Recency recency;  // most recently used first
+    std::map<NodeKey, Recency::iterator> cached;
+    unsigned long hits, misses;
+
+    // the cached node for the block (now the most recently used), or nullptr
+    BTreeNode *find(HeapFile &file, BlockID block_id);
+
+    void add(HeapFile &file, BTreeNode *node);
+};
@@ -0,0 +1,131 @@
+/**
+ * @file buffer_pool.h - Buffer pool of block frames in front of the heap files.
+ * BufferFrame, BufferPool
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include "storage_engine.h"
+
+class HeapFile;
+
+/**
+ * @class BufferFrame - one block-sized frame in the buffer pool
+ *
+ * A frame is pinned while any SlottedPage is using its bytes and can only be
+ * reused for another block once its pin count drops back to zero. The pool
+ * pins a frame under its latch, but a copied SlottedPage pins it again and
+ * every page unpins it without one, so the count and the referenced bit are
+ * atomic.
+ */
+class BufferFrame {
+  public:
+    BufferFrame() : file(nullptr), block_id(0), pin_count(0), dirty(false), referenced(false) {}
+
+    virtual ~BufferFrame() {}
+
+    BufferFrame(const BufferFrame &other) = delete;
+
+    BufferFrame &operator=(const BufferFrame &other) = delete;
+
+    void pin() {
+        this->pin_count++;
+        this->referenced = true;
+    }
+
+    void unpin() {
+        uint count = this->pin_count;
+        do {
+            if (count == 0)
+                throw DbRelationError("unpin of a buffer frame that isn't pinned");
+        } while (!this->pin_count.compare_exchange_weak(count, count - 1));
+    }
+
+    char *get_data() { return this->data; }
+
+    friend class BufferPool;
+
+  protected:
+    char data[DbBlock::BLOCK_SZ];
+    HeapFile *file;  // nullptr if the frame is free or its file was discarded while it was pinned
+    BlockID block_id;
+    std::atomic<uint> pin_count;
+    bool dirty;
+    std::atomic<bool> referenced;  // second-chance bit for CLOCK replacement
+};
+
+/**
+ * @class BufferPool - fixed set of frames caching heap file blocks
+ *
+ * Blocks are read into a frame on first use and stay resident until CLOCK
+ * replacement picks their (unpinned) frame for another block. Changes are kept
+ * in the frame and written back to the file when the frame is evicted or the
+ * pool is flushed. All of this happens under one latch, so threads scanning in
+ * parallel can share the pool (their reads of the files are serialized).
+ */
+class BufferPool {
+  public:
+    static const uint DEFAULT_FRAMES = 256;
+
+    /**
+     * The buffer pool shared by all the heap files.
+     * @return the pool
+     */
+    static BufferPool &instance();
+
+    BufferPool(uint frame_count = DEFAULT_FRAMES);
+
+    virtual ~BufferPool();
+
+    BufferPool(const BufferPool &other) = delete;
+
+    BufferPool &operator=(const BufferPool &other) = delete;
+
+    virtual BufferFrame *pin(HeapFile *file, BlockID block_id);
+
+    virtual BufferFrame *pin_new(HeapFile *file, BlockID block_id);
+
+    virtual void put(HeapFile *file, BlockID block_id, const void *data);
+
+    virtual void flush(HeapFile *file = nullptr);
+
+    virtual void discard(HeapFile *file);
+
+    uint get_frame_count() const { return this->frame_count; }
+
+    uint get_pinned_count() const;
+
+    unsigned long get_hits() const { return this->hits; }
+
+    unsigned long get_misses() const { return this->misses; }
+
+    unsigned long get_evictions() const { return this->evictions; }
+
+    unsigned long get_writes() const { return this->writes; }
+
+    void reset_counters() { this->hits = this->misses = this->evictions = this->writes = 0; }
+
+  protected:
+    typedef std::pair<HeapFile *, BlockID> FrameKey;
+
+    uint frame_count;
+    BufferFrame *frames;
+    std::map<FrameKey, BufferFrame *> resident;
+    uint clock_hand;
+    unsigned long hits, misses, evictions, writes;
+    std::mutex latch;
+
+    virtual BufferFrame *victim();
+
+    virtual void write_back(BufferFrame *frame);
+};
+
+std::ostream &operator<<(std::ostream &out, const BufferPool &pool);
+
+bool test_buffer_pool();
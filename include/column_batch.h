@@ -0,0 +1,96 @@
+/**
+ * @file column_batch.h - Column-at-a-time batches of rows for the vectorized executor.
+ * ColumnVector, ColumnBatch, BatchScan
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class ColumnVector - the values of one column for each row of a ColumnBatch
+ *
+ * INT and BOOLEAN values are held as int32's. TEXT values are copied end to
+ * end into an arena, with an offset and length for each row.
+ */
+class ColumnVector {
+  public:
+    ColumnVector(ColumnAttribute::DataType data_type, uint capacity);
+
+    virtual ~ColumnVector() {}
+
+    ColumnAttribute::DataType data_type;
+    std::vector<int32_t> ints;        // INT and BOOLEAN
+    std::vector<uint32_t> offsets;    // TEXT: where each row's value starts in arena
+    std::vector<uint16_t> lengths;    // TEXT: number of bytes in each row's value
+    std::vector<char> arena;          // TEXT: the bytes of all the values
+
+    void clear() { arena.clear(); }
+
+    /**
+     * Store a TEXT value for the given row.
+     * @param row    row within the batch
+     * @param bytes  the text (not nul-terminated)
+     * @param size   number of bytes
+     */
+    void put_text(uint row, const char *bytes, uint16_t size) {
+        offsets[row] = (uint32_t) arena.size();
+        lengths[row] = size;
+        arena.insert(arena.end(), bytes, bytes + size);
+    }
+
+    const char *text(uint row) const { return arena.data() + offsets[row]; }
+
+    /**
+     * Build the Value held for the given row.
+     * @param row  row within the batch
+     * @return     the value
+     */
+    Value get_value(uint row) const;
+};
+
+/**
+ * @class ColumnBatch - up to CAPACITY rows of some of a table's columns, stored
+ * column by column, with a selection vector of the rows still qualifying
+ */
+class ColumnBatch {
+  public:
+    static const uint CAPACITY = 1024;
+
+    ColumnBatch(const ColumnAttributes &column_attributes);
+
+    virtual ~ColumnBatch();
+
+    ColumnBatch(const ColumnBatch &other) = delete;
+
+    ColumnBatch &operator=(const ColumnBatch &other) = delete;
+
+    std::vector<ColumnVector *> columns;  // one per column asked for, in the order asked for
+    uint size;                            // number of rows loaded
+    uint16_t selection[CAPACITY];         // positions of the qualifying rows, in order
+    uint selected;                        // number of entries in selection
+
+    // empty the batch for reloading
+    void clear();
+
+    // mark every loaded row as qualifying
+    void select_all();
+};
+
+/**
+ * @class BatchScan - fills ColumnBatches from a relation, a batch at a time
+ */
+class BatchScan {
+  public:
+    virtual ~BatchScan() {}
+
+    /**
+     * Load the next rows into batch (replacing what was there) and select them all.
+     * @param batch  batch laid out for the columns the scan was made for
+     * @returns      false if there were no more rows
+     */
+    virtual bool next(ColumnBatch &batch) = 0;
+};
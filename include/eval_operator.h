@@ -0,0 +1,229 @@
+/**
+ * @file eval_operator.h - Pull-based (open/next/close) operators that an EvalPlan compiles into.
+ * HandleOperator: TableScanOperator, IndexLookupOperator, IndexRangeOperator, SelectOperator
+ * RowOperator: ProjectOperator, ScanProjectOperator, LimitOperator
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class HandleOperator - produces the handles of qualifying rows of one table, one at a time
+ *
+ * Call open() before the first next() and close() after the last. Each
+ * operator keeps its own copy of its predicates, so it does not depend on
+ * the plan it was compiled from.
+ */
+class HandleOperator {
+  public:
+    /**
+     * Handles are pulled from a child in batches of this size, so the table can
+     * fetch each block only once for all the handles of the batch that are on it.
+     */
+    static const uint BATCH_SIZE = 256;
+
+    HandleOperator(DbRelation &table) : table(table) {}
+
+    virtual ~HandleOperator() {}
+
+    virtual void open() = 0;
+
+    /**
+     * Produce the next handle.
+     * @param handle  set to the next handle
+     * @returns       false if there are no more
+     */
+    virtual bool next(Handle &handle) = 0;
+
+    virtual void close() = 0;
+
+    DbRelation &get_table() const { return table; }
+
+  protected:
+    DbRelation &table;
+};
+
+/**
+ * @class RowOperator - produces projected rows, one at a time
+ */
+class RowOperator {
+  public:
+    virtual ~RowOperator() {}
+
+    virtual void open() = 0;
+
+    /**
+     * Produce the next row.
+     * @param row  set to the next row's values, in projection order (freed by caller)
+     * @returns    false if there are no more
+     */
+    virtual bool next(Row *&row) = 0;
+
+    virtual void close() = 0;
+};
+
+/**
+ * @class TableScanOperator - every row of a table satisfying the (optional) predicates
+ */
+class TableScanOperator : public HandleOperator {
+  public:
+    TableScanOperator(DbRelation &table, const ValueDict *where = nullptr, const ValueRanges *ranges = nullptr);
+
+    virtual ~TableScanOperator();
+
+    virtual void open();
+
+    virtual bool next(Handle &handle);
+
+    virtual void close();
+
+  protected:
+    ValueDict where;
+    ValueRanges ranges;
+    HandleIterator *scan;
+};
+
+/**
+ * @class IndexLookupOperator - the rows whose index key equals the given key
+ */
+class IndexLookupOperator : public HandleOperator {
+  public:
+    IndexLookupOperator(DbIndex &index, DbRelation &table, const ValueDict *key);
+
+    virtual ~IndexLookupOperator();
+
+    virtual void open();
+
+    virtual bool next(Handle &handle);
+
+    virtual void close();
+
+  protected:
+    DbIndex &index;
+    ValueDict key;
+    Handles *handles;
+    u_long i;
+};
+
+/**
+ * @class IndexRangeOperator - the rows whose index key is between min_key and max_key (inclusive)
+ */
+class IndexRangeOperator : public HandleOperator {
+  public:
+    IndexRangeOperator(DbIndex &index, DbRelation &table, const ValueDict *min_key, const ValueDict *max_key);
+
+    virtual ~IndexRangeOperator();
+
+    virtual void open();
+
+    virtual bool next(Handle &handle);
+
+    virtual void close();
+
+  protected:
+    DbIndex &index;
+    ValueDict *min_key;
+    ValueDict *max_key;
+    Handles *handles;
+    u_long i;
+};
+
+/**
+ * @class SelectOperator - the child's handles whose rows satisfy the predicates
+ */
+class SelectOperator : public HandleOperator {
+  public:
+    SelectOperator(HandleOperator *child, const ValueDict *where, const ValueRanges *ranges);
+
+    virtual ~SelectOperator();
+
+    virtual void open();
+
+    virtual bool next(Handle &handle);
+
+    virtual void close();
+
+  protected:
+    HandleOperator *child;
+    ValueDict where;
+    ValueRanges ranges;
+    Handles *selected;
+    u_long i;
+};
+
+/**
+ * @class ProjectOperator - the child's rows, projected to the given columns
+ */
+class ProjectOperator : public RowOperator {
+  public:
+    ProjectOperator(HandleOperator *child, const ColumnNames *column_names, QueryArena *arena = nullptr);
+
+    virtual ~ProjectOperator();
+
+    virtual void open();
+
+    virtual bool next(Row *&row);
+
+    virtual void close();
+
+  protected:
+    HandleOperator *child;
+    ColumnNames column_names;
+    QueryArena *arena;
+    Rows *rows;
+    u_long i;
+
+    void clear();
+};
+
+/**
+ * @class ScanProjectOperator - a table scan with its select and project done together,
+ * decoding each row straight from the block the scan is on
+ */
+class ScanProjectOperator : public RowOperator {
+  public:
+    ScanProjectOperator(DbRelation &table, const ColumnNames *column_names, const ValueDict *where = nullptr,
+                        const ValueRanges *ranges = nullptr, QueryArena *arena = nullptr);
+
+    virtual ~ScanProjectOperator();
+
+    virtual void open();
+
+    virtual bool next(Row *&row);
+
+    virtual void close();
+
+  protected:
+    DbRelation &table;
+    ColumnNames column_names;
+    ValueDict where;
+    ValueRanges ranges;
+    QueryArena *arena;
+    RowIterator *rows;
+};
+
+/**
+ * @class LimitOperator - skips the child's first offset rows, then passes on at most limit rows
+ */
+class LimitOperator : public RowOperator {
+  public:
+    LimitOperator(RowOperator *child, u_long limit, u_long offset = 0);
+
+    virtual ~LimitOperator();
+
+    virtual void open();
+
+    virtual bool next(Row *&row);
+
+    virtual void close();
+
+  protected:
+    RowOperator *child;
+    u_long limit;
+    u_long offset;
+    u_long skipped;
+    u_long produced;
+};
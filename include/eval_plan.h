@@ -7,38 +7,65 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "eval_operator.h"
 
+class Indices;
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
 
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexLookup, IndexRange, Limit
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ValueDict *conjunction, ValueRanges *ranges, EvalPlan *relation);  // use for Select with ranges
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbIndex &index, DbRelation &table, ValueDict *key);  // use for IndexLookup
+    EvalPlan(DbIndex &index, DbRelation &table, ValueDict *min_key, ValueDict *max_key);  // use for IndexRange
+    EvalPlan(u_long limit, u_long offset, EvalPlan *relation);  // use for Limit (above a projection)
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan (using the given table's indices, if any)
+    EvalPlan *optimize(Indices *indices = nullptr);
 
     // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    Rows *evaluate();  // each row in projection order
 
     EvalPipeline pipeline();
 
+    // Turn the plan into pull-based operators that produce its rows one at a time (freed by caller), keeping the
+    // rows' values in arena if given one
+    RowOperator *compile(QueryArena *arena = nullptr) const;
+
+    // Like compile(), but using the vectorized executor (split across up to workers threads if the table is big
+    // enough); nullptr if the plan isn't a table scan it can run. A parallel scan's rows are made on the heap.
+    RowOperator *vectorize(uint workers = 1, QueryArena *arena = nullptr) const;
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for everything except TableScan, IndexLookup, and IndexRange
     ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
-};
+    ValueDict *select_conjunction;  // for Select (and the search key for IndexLookup)
+    ValueRanges *select_ranges;  // for Select
+    DbRelation &table;  // for TableScan, IndexLookup, and IndexRange
+    DbIndex *index;  // for IndexLookup and IndexRange
+    ValueDict *min_key;  // for IndexRange (inclusive, nullptr if unbounded)
+    ValueDict *max_key;  // for IndexRange (inclusive, nullptr if unbounded)
+    u_long limit;  // for Limit
+    u_long offset;  // for Limit
+
+    void use_indices(Indices *indices);
 
+    bool use_index_lookup(Indices *indices);
+
+    bool use_index_range(Indices *indices);
+
+    HandleOperator *compile_handles() const;
+};
 
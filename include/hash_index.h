@@ -0,0 +1,103 @@
+/**
+ * @file hash_index.h - HashIndex class
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "btree_node.h"
+
+/**
+ * @class HashIndex - on-disk linear hashing index
+ *
+ * Bucket b is block b + 2 of the index's file (block 1 holds the index's
+ * state), followed by a chain of overflow blocks in a second file. The
+ * buckets grow one at a time: when the entries would fill more than
+ * load_factor percent of the buckets' space, the bucket at the split
+ * pointer is split in two by one more bit of the hash, so the number of
+ * buckets stays in line with the number of entries without a directory
+ * and without rehashing everything at once (Litwin's linear hashing).
+ *
+ * Each entry is one record: the key's hash, the row's handle, then the
+ * key normalized as BTreeNode::normalize_key does it. Keys needn't be
+ * unique; a unique index checks the bucket before adding. There's no
+ * order, so only lookups (not ranges) are supported.
+ */
+class HashIndex : public DbIndex {
+public:
+    static const uint32_t INITIAL_BUCKETS = 4;
+    static const uint DEFAULT_LOAD_FACTOR = 75;
+
+    HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~HashIndex();
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    using DbIndex::insert;
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    using DbIndex::del;
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    uint32_t get_bucket_count() const { return (INITIAL_BUCKETS << this->level) + this->next; }
+
+    // blocks of overflow chained off the buckets (including any freed by splits for reuse)
+    uint32_t get_overflow_count() { return this->overflow.get_last_block_id() - 1; }
+
+protected:
+    static const BlockID META = 1;
+    static const u_long ENTRY_HEADER = sizeof(uint32_t) + sizeof(BlockID) + sizeof(RecordID);
+
+    bool closed;
+    HeapFile file;
+    HeapFile overflow;
+    KeyProfile key_profile;
+    uint load_factor;
+    uint32_t level;  // the buckets numbered below INITIAL_BUCKETS << level hash by that many bits...
+    uint32_t next;   // ...except those below next, which have been split and hash by one more
+    uint32_t entries;
+    uint32_t entry_bytes;
+    BlockID free_overflow;  // first of the overflow blocks freed by splits, linked like a chain
+
+    void read_meta();
+
+    void save_meta();
+
+    // the normalized key columns of a row or search key
+    std::string normalized(const ValueDict *key) const;
+
+    static uint32_t hash(const std::string &key);
+
+    uint32_t bucket_of(uint32_t hash) const;
+
+    // the next block in a bucket's chain after page (0 if none), which is from overflow
+    static BlockID get_link(const SlottedPage *page);
+
+    static void put_link(SlottedPage *page, BlockID link);
+
+    // free an overflow block that is no longer in any chain, for append to reuse
+    void free_block(BlockID block_id);
+
+    // add an entry record to the end of a bucket's chain, taking an overflow block if the chain is full
+    void append(uint32_t bucket, const Dbt &entry);
+
+    void add(const std::string &key, Handle handle);
+
+    void split();
+
+    friend bool test_hash_index();
+};
+
+bool test_hash_index();
@@ -14,15 +14,15 @@
  * @class HeapFile - heap file implementation of DbFile
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one
- of our database blocks for each Berkeley DB record in the RecNo file. In this
- way we are using Berkeley DB for buffer management and file management. Uses
- SlottedPage for storing records within blocks.
+ of our database blocks for each Berkeley DB record in the RecNo file. Blocks
+ are cached in the shared BufferPool, so Berkeley DB is only used for file
+ management. Uses SlottedPage for storing records within blocks.
  */
 class HeapFile : public DbFile {
   public:
     HeapFile(std::string name);
 
-    virtual ~HeapFile() {}
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -48,6 +48,8 @@ class HeapFile : public DbFile {
 
     virtual BlockIDs *block_ids() const;
 
+    virtual BlockIterator *blocks() const;
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
@@ -63,4 +65,10 @@ class HeapFile : public DbFile {
     virtual void db_open(uint flags = 0);
 
     virtual uint32_t get_block_count();
+
+    virtual void read_block(BlockID block_id, void *buffer);
+
+    virtual void write_block(BlockID block_id, const void *buffer);
+
+    friend class BufferPool;
 };
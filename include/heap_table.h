@@ -13,10 +13,21 @@
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * Each block's format (SlottedPage::get_format) says how its records are laid
+ * out. ROW_V1 records are the values one after another, each TEXT value with
+ * its length in front, so getting to a column means walking every one before
+ * it. ROW_V2 records start with a 2-byte offset to each value and a null
+ * bitmap, so any column can be gotten to directly. New rows are all written as
+ * ROW_V2, into ROW_V2 blocks; ROW_V1 blocks (from before there were formats)
+ * are still read but not added to.
  */
 
 class HeapTable : public DbRelation {
   public:
+    static const uint16_t ROW_V1 = 0;
+    static const uint16_t ROW_V2 = 1;
+
     HeapTable(Identifier table_name, ColumnNames column_names,
               ColumnAttributes column_attributes);
 
@@ -52,24 +63,74 @@ class HeapTable : public DbRelation {
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual Handles *select(const ValueDict *where, const ValueRanges *ranges);
+
+    virtual Handles *select(Handles *current_selection, const ValueDict *where, const ValueRanges *ranges);
+
+    virtual HandleIterator *scan(const ValueDict *where = nullptr, const ValueRanges *ranges = nullptr);
+
+    virtual RowIterator *rows(const ColumnNames *column_names, const ValueDict *where = nullptr,
+                              const ValueRanges *ranges = nullptr, QueryArena *arena = nullptr);
+
+    virtual BatchScan *batches(const ColumnNames *column_names);
+
+    virtual uint morsel_count(uint blocks_per_morsel);
+
+    virtual BatchScan *batches(const ColumnNames *column_names, uint morsel, uint blocks_per_morsel);
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names);
+
     using DbRelation::project;
 
+    virtual Rows *project_rows(Handles *handles, const ColumnNames *column_names, QueryArena *arena = nullptr);
+
   protected:
     HeapFile file;
 
-    virtual ValueDict *validate(const ValueDict *row) const;
+    virtual Row *validate(const ValueDict *row) const;
+
+    virtual Handle append(const Row *row);
+
+    // as a ROW_V2 record
+    virtual Dbt *marshal(const Row *row) const;
+
+    // the leading columns of a ROW_V1 record
+    virtual Row *unmarshal(const char *bytes, uint columns) const;
+
+    // where column col_num's value is in a ROW_V2 record (nullptr if it's NULL)
+    const char *field(const char *bytes, u_int16_t record_size, uint col_num, u_int16_t &size) const;
+
+    // one value of a ROW_V2 record
+    Value unmarshal(const char *bytes, u_int16_t record_size, uint col_num) const;
+
+    // position in the table of each of column_names (all the columns if empty)
+    std::vector<uint> positions(const ColumnNames *column_names) const;
+
+    // a record's bytes are read where they are in its block (as from SlottedPage::get_bytes), not copied out
+    virtual Row *project(const char *bytes, u_int16_t size, uint16_t format, const std::vector<uint> &positions,
+                         QueryArena *arena = nullptr) const;
+
+    virtual bool selected(Handle handle, const ValueDict *where, const ValueRanges *ranges = nullptr);
+
+    virtual bool selected(SlottedPage *block, RecordID record_id, const ValueDict *where,
+                          const ValueRanges *ranges = nullptr) const;
 
-    virtual Handle append(const ValueDict *row);
+    virtual bool selected(const char *bytes, u_int16_t size, uint16_t format, const ValueDict *where,
+                          const ValueRanges *ranges = nullptr) const;
 
-    virtual Dbt *marshal(const ValueDict *row) const;
+    void check_columns(const ValueDict *where, const ValueRanges *ranges = nullptr) const;
 
-    virtual ValueDict *unmarshal(Dbt *data) const;
+    void check_columns(const ColumnNames *column_names) const;
 
-    virtual bool selected(Handle handle, const ValueDict *where);
+    friend class HeapTableScan;
+    friend class HeapTableRows;
+    friend class HeapTableBatches;
+    friend bool test_row_formats();
 };
 
+bool test_row_formats();
 bool test_heap_storage();
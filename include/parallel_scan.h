@@ -0,0 +1,97 @@
+/**
+ * @file parallel_scan.h - Morsel-driven parallel table scan.
+ * ParallelScan
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "batch_exec.h"
+#include "thread_pool.h"
+
+/**
+ * @class ParallelScan - a table scan with its select and project, split into
+ * morsels (runs of blocks) that are scanned on the ThreadPool's workers
+ *
+ * Each worker runs its own copy of a BatchExecutor, taking the next morsel
+ * nobody has started yet whenever it finishes one, so fast and slow workers
+ * even out. The rows come out in table order if ordered is set, otherwise
+ * morsel by morsel in the order they finish. Workers only run a few morsels
+ * ahead of the rows being consumed, and the consuming thread scans a morsel
+ * itself rather than sit idle waiting for one.
+ */
+class ParallelScan : public RowOperator {
+  public:
+    static const uint BLOCKS_PER_MORSEL = 16;
+
+    /**
+     * Make a parallel scan, if the table can be split into more than one morsel.
+     * @param table       table to scan
+     * @param projection  columns of the result rows
+     * @param where       equality predicates (may be nullptr)
+     * @param ranges      range predicates (may be nullptr)
+     * @param workers     most threads to use (counting the one pulling the rows)
+     * @param ordered     whether the rows must come out in table order
+     * @returns           the scan (freed by caller), or nullptr if there's nothing to split
+     */
+    static ParallelScan *create(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                                const ValueRanges *ranges, uint workers, bool ordered = true);
+
+    ParallelScan(const ParallelScan &other) = delete;
+
+    ParallelScan &operator=(const ParallelScan &other) = delete;
+
+    virtual ~ParallelScan();
+
+    virtual void open();
+
+    virtual bool next(Row *&row);
+
+    virtual void close();
+
+  protected:
+    BatchExecutor *prototype;  // each worker scans with a copy of this
+    BatchExecutor *local;      // the consuming thread's copy
+    uint workers;
+    bool ordered;
+    uint morsels;
+
+    std::mutex lock;                   // guards everything below
+    std::condition_variable changed;   // a morsel finished, one was consumed, or a worker quit
+    uint started;                      // morsels handed out so far (they are handed out in order)
+    uint consumed;                     // morsels whose rows next() has moved on to
+    std::vector<Rows *> results;       // rows of each finished morsel not yet consumed
+    std::vector<uint> finished;        // finished morsels not yet consumed, in the order they finished
+    uint running;                      // workers still in their loop
+    bool stopping;
+    std::string error;                 // message of the first exception a worker hit
+
+    Rows *current;                     // rows of the morsel being consumed
+    u_long i;
+
+    ParallelScan(BatchExecutor *prototype, uint morsels, uint workers, bool ordered);
+
+    void work();
+
+    Rows *scan_morsel(BatchExecutor &executor, uint morsel);
+
+    bool take(uint &morsel);
+
+    void finish(uint morsel, Rows *rows);
+
+    void free_rows(Rows *rows, u_long from = 0);
+};
+
+/**
+ * Time a selective scan of a generated table with 1, 2, 4, ... up to the
+ * ThreadPool's thread count, and print rows/sec for each.
+ * @param out   where to print
+ * @param rows  rows in the table
+ */
+void benchmark_parallel_scan(std::ostream &out, uint rows = 1000000);
+
+bool test_parallel_scan();
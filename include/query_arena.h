@@ -0,0 +1,121 @@
+/**
+ * @file query_arena.h - Memory for the rows of one query, freed all at once.
+ * QueryArena, ArenaAllocator
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @class QueryArena - allocator for the small, short-lived blocks a query makes
+ * by the thousand (the values of each row it returns)
+ *
+ * Blocks are carved one after another out of big chunks taken from the heap,
+ * and all the chunks are given back together when the arena is deleted, which
+ * SQLExec has the QueryResult do once the query's rows have been pulled. A
+ * block given back early goes on a free list for its size, so a query
+ * streaming rows one at a time keeps reusing the same few blocks rather than
+ * growing. Blocks too big to pool come straight from the heap.
+ *
+ * Not latched: an arena is used by one thread at a time (the parallel scan's
+ * workers make their rows on the heap).
+ */
+class QueryArena {
+  public:
+    static const size_t CHUNK_SZ = 64 * 1024;
+    static const size_t ALIGNMENT = alignof(std::max_align_t);
+    static const size_t MAX_POOLED = 4096;  // bigger blocks come from the heap
+
+    QueryArena();
+
+    virtual ~QueryArena();
+
+    QueryArena(const QueryArena &other) = delete;
+
+    QueryArena &operator=(const QueryArena &other) = delete;
+
+    void *allocate(size_t size);
+
+    // give back a block from allocate(size), to be reused for another of about the same size
+    void free(void *block, size_t size);
+
+    // blocks asked for, and their bytes
+    unsigned long get_allocations() const { return this->allocations; }
+
+    unsigned long get_bytes() const { return this->bytes; }
+
+    // of those, how many were given back and reused
+    unsigned long get_reused() const { return this->reused; }
+
+    // what it took from the heap to serve them: the chunks, plus each block too big to pool
+    unsigned long get_heap_allocations() const { return this->heap_allocations; }
+
+    unsigned long get_heap_bytes() const { return this->heap_bytes; }
+
+  protected:
+    static const size_t SIZE_CLASSES = MAX_POOLED / ALIGNMENT;
+
+    std::vector<char *> chunks;
+    char *next;  // the rest of the last chunk
+    char *end;
+    void *free_lists[SIZE_CLASSES];  // each block given back holds the next one's address
+    unsigned long allocations, bytes, reused, heap_allocations, heap_bytes;
+
+    static size_t size_class(size_t size) { return (size + ALIGNMENT - 1) / ALIGNMENT - 1; }
+};
+
+std::ostream &operator<<(std::ostream &out, const QueryArena &arena);
+
+/**
+ * @class ArenaAllocator - standard library allocator taking from a QueryArena,
+ * or from the heap if it has none
+ *
+ * A copy of a container made with one allocates from the heap, so it can
+ * outlive the query.
+ */
+template<typename T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(QueryArena *arena = nullptr) : arena(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.get_arena()) {}
+
+    T *allocate(size_t n) {
+        if (this->arena == nullptr)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        return static_cast<T *>(this->arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (this->arena == nullptr)
+            ::operator delete(p);
+        else
+            this->arena->free(p, n * sizeof(T));
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    QueryArena *get_arena() const { return this->arena; }
+
+  protected:
+    QueryArena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.get_arena() == b.get_arena(); }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.get_arena() != b.get_arena(); }
+
+bool test_query_arena();
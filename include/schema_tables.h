@@ -148,6 +148,14 @@ class Indices : public HeapTable {
      */
     virtual IndexNames get_index_names(Identifier table_name);
 
+    /**
+     * Check a row about to be inserted against the unique indices on its table.
+     * @param table_name  table the row is for
+     * @param row         the row
+     * @returns           true if one of them already has the row's key
+     */
+    virtual bool has_duplicate(Identifier table_name, ValueDict *row);
+
     // overrides
     virtual Handle insert(const ValueDict *row);
 
@@ -161,3 +169,5 @@ class Indices : public HeapTable {
   private:
     static std::map<std::pair<Identifier, Identifier>, DbIndex *> index_cache;
 };
+
+bool test_unique_probe();
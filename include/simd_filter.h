@@ -0,0 +1,80 @@
+/**
+ * @file simd_filter.h - Comparison kernels over int32 column arrays, in SIMD where the CPU has it.
+ * IntFilter
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+/**
+ * @class IntFilter - compares an array of int32's (INT or BOOLEAN column values)
+ * against a constant
+ *
+ * The result is a bitmask with one bit per row, in 64-bit words (bit i of word
+ * w is row 64*w + i). Each kernel ANDs its result into the mask, so a
+ * conjunction is just one call per predicate on the same mask. There is an
+ * AVX2, an SSE4.2 and a scalar version of each kernel; the best one this CPU
+ * can run is picked the first time it is needed.
+ */
+class IntFilter {
+  public:
+    enum Op {
+        EQ, LT, LE, GT, GE
+    };
+
+    enum Level {
+        SCALAR, SSE42, AVX2
+    };
+
+    static const char *level_name(Level level);
+
+    // best kernel level this CPU supports
+    static Level best_level();
+
+    // number of mask words needed for n rows
+    static uint mask_words(uint n) { return (n + 63) / 64; }
+
+    /**
+     * Set the mask to have bits 0..n-1 on (and the rest of its last word off).
+     * @param mask  mask of at least mask_words(n) words
+     * @param n     number of rows
+     */
+    static void set_all(uint64_t *mask, uint n);
+
+    /**
+     * Clear the bit of each row i in 0..n-1 unless values[i] op k.
+     * @param values  column values
+     * @param n       number of rows
+     * @param op      comparison
+     * @param k       constant to compare against
+     * @param mask    mask of at least mask_words(n) words
+     */
+    static void filter(const int32_t *values, uint n, Op op, int32_t k, uint64_t *mask) {
+        filter(best_level(), values, n, op, k, mask);
+    }
+
+    // same, with the given level's kernel (which the CPU must support)
+    static void filter(Level level, const int32_t *values, uint n, Op op, int32_t k, uint64_t *mask);
+
+    /**
+     * Write the row numbers whose bits are on, in order.
+     * @param mask       mask of at least mask_words(n) words
+     * @param n          number of rows
+     * @param selection  where to write them (room for n)
+     * @returns          how many were written
+     */
+    static uint to_selection(const uint64_t *mask, uint n, uint16_t *selection);
+
+    /**
+     * Time every kernel this CPU supports and print rows/sec for each.
+     * @param out   where to print
+     * @param rows  rows in each pass
+     */
+    static void benchmark(std::ostream &out, uint rows = 1 << 20);
+};
+
+bool test_int_filter();
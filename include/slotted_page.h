@@ -8,6 +8,7 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "buffer_pool.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -21,14 +22,22 @@
  beginning of the block: Bytes 0x00 - Ox01: number of records Bytes 0x02 - 0x03:
  offset to end of free space Bytes 0x04 - 0x05: size of record 1 Bytes 0x06 -
  0x07: offset to record 1 etc.
+
+        The offset to the end of free space never needs more than 12 bits, so
+ the top 4 bits of it hold the page's format: a number for the user of the
+ page to say how its records are laid out (0 for pages that predate it).
  *
  */
 class SlottedPage : public DbBlock {
   public:
-    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
+    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false, BufferFrame *frame = nullptr);
+
+    // Big 5 - copies share (and pin) the same buffer pool frame
+    virtual ~SlottedPage();
+
+    SlottedPage(const SlottedPage &other);
 
-    // Big 5 - use the defaults
-    virtual ~SlottedPage() {}
+    SlottedPage &operator=(const SlottedPage &other);
 
     virtual RecordID add(const Dbt *data);
 
@@ -46,9 +55,43 @@ class SlottedPage : public DbBlock {
 
     virtual u_int16_t unused_bytes() const;
 
+    /**
+     * Add a new record as record_id, moving record_id and every record after it up one id.
+     * Lets a caller keep its records in some order by id without rewriting the block.
+     * @param record_id  1 to one past the last id
+     * @param data       the new record
+     * @throws           DbBlockNoRoomError if it won't fit
+     */
+    virtual void insert(RecordID record_id, const Dbt *data);
+
+    /**
+     * Remove a record, moving every record after it down one id (unlike del, which leaves a tombstone).
+     * @param record_id  record to remove
+     */
+    virtual void erase(RecordID record_id);
+
+    /**
+     * Where a record's bytes are in the block, without copying them. Only good until the block changes.
+     * @param record_id  which record
+     * @param size       set to the record's size
+     * @return           the record's first byte, or nullptr if it has been deleted
+     */
+    const char *get_bytes(RecordID record_id, u_int16_t &size) const;
+
+    // highest record id handed out so far (deleted records included)
+    RecordID last_id() const { return this->num_records; }
+
+    static const uint16_t MAX_FORMAT = 15;
+
+    uint16_t get_format() const { return this->format; }
+
+    void set_format(uint16_t format);
+
 protected:
     uint16_t num_records;
     uint16_t end_free;
+    uint16_t format;
+    BufferFrame *frame;  // buffer pool frame holding the block (if any), pinned until this page goes away
 
     void get_header(uint16_t &size, uint16_t &loc, RecordID id = 0) const;
 
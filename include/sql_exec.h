@@ -22,21 +22,30 @@ class SQLExecError : public std::runtime_error {
 /**
  * @class QueryResult - data structure to hold all the returned data for a query
  * execution
+ *
+ * The rows of a SELECT are not collected up front: they are pulled from the
+ * stream of plan operators as they are printed (or when get_rows() is called).
+ * Their values are kept in the query's arena, which goes when the result does.
  */
 class QueryResult {
   public:
     QueryResult()
         : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-          message("") {}
+          stream(nullptr), arena(nullptr), message("") {}
 
     QueryResult(std::string message)
         : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-          message(message) {}
+          stream(nullptr), arena(nullptr), message(message) {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes,
                 ValueDicts *rows, std::string message)
         : column_names(column_names), column_attributes(column_attributes),
-          rows(rows), message(message) {}
+          rows(rows), stream(nullptr), arena(nullptr), message(message) {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes,
+                RowOperator *stream, QueryArena *arena = nullptr)
+        : column_names(column_names), column_attributes(column_attributes),
+          rows(nullptr), stream(stream), arena(arena), message("") {}
 
     virtual ~QueryResult();
 
@@ -46,9 +55,12 @@ class QueryResult {
         return column_attributes;
     }
 
-    ValueDicts *get_rows() const { return rows; }
+    ValueDicts *get_rows() const;
+
+    // where the query's rows were made (nullptr if not a SELECT)
+    const QueryArena *get_arena() const { return arena; }
 
-    const std::string &get_message() const { return message; }
+    const std::string &get_message() const;
 
     friend std::ostream &operator<<(std::ostream &stream,
                                     const QueryResult &qres);
@@ -56,8 +68,12 @@ class QueryResult {
   protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
-    ValueDicts *rows;
-    std::string message;
+    mutable ValueDicts *rows;
+    mutable RowOperator *stream;  // (opened) source of the rows, until they have all been pulled
+    QueryArena *arena;
+    mutable std::string message;
+
+    void end_stream() const;
 };
 
 /**
@@ -77,6 +93,25 @@ class SQLExec {
      */
     static void close();
 
+    /**
+     * Whether SELECTs that scan a table are run by the vectorized executor (on by default).
+     * Big tables are then scanned in parallel by the ThreadPool's threads.
+     */
+    static bool vectorized;
+
+    /**
+     * Fill factor (percent, 10 to 100) that CREATE INDEX gives new BTREE indices;
+     * see BTreeIndex::set_fill_factor. The parser has no syntax for index
+     * options, so it is set from the shell ("fillfactor N") instead.
+     */
+    static uint index_fill_factor;
+
+    /**
+     * Whether printing a SELECT's result also reports how much memory its
+     * rows took from its QueryArena, and from the heap (off by default).
+     */
+    static bool report_memory;
+
   protected:
     // the one place in the system that holds the _tables and _indices tables
     static Tables *tables;
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "db_cxx.h"
+#include "query_arena.h"
 #include <exception>
 #include <map>
 #include <utility>
@@ -135,13 +136,27 @@ class DbBlock {
 };
 
 // convenience type alias
-typedef std::vector<BlockID>
-    BlockIDs; // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs; // materialized list; see BlockIterator for streaming
+
+/**
+ * @class BlockIterator - streams the BlockIDs of a DbFile one at a time
+ */
+class BlockIterator {
+  public:
+    virtual ~BlockIterator() {}
+
+    /**
+     * Advance to the next block.
+     * @param block_id  set to the next block's id
+     * @returns         false if there are no more blocks
+     */
+    virtual bool next(BlockID &block_id) = 0;
+};
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection
  *of DbBlocks create() drop() open() close() get_new() get(block_id) put(block)
- *	block_ids()
+ *	block_ids() blocks()
  */
 class DbFile {
   public:
@@ -191,12 +206,18 @@ class DbFile {
 
     /**
      * Get a list of all the valid BlockID's in the file
-     * FIXME - not a good long-term approach, but we'll do this until we put in
-     * iterators
+     * (use blocks() to avoid materializing the whole list)
      * @returns  a pointer to vector of BlockIDs (freed by caller)
      */
     virtual BlockIDs *block_ids() const = 0;
 
+    /**
+     * Iterate over all the valid BlockID's in the file.
+     * The default just walks the list from block_ids().
+     * @returns  an iterator over the BlockIDs (freed by caller)
+     */
+    virtual BlockIterator *blocks() const;
+
   protected:
     std::string name; // filename (or part of it)
 };
@@ -253,11 +274,98 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle>
-    Handles; // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<Handle> Handles; // materialized list; see HandleIterator for streaming
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
 
+// A row's values by position, in the order of the column names that go with it (the table's, or a projection's).
+// This is what flows through scans and plan operators; a ValueDict is only made at the edges. The values of a
+// query's rows are kept in its QueryArena, if it was given one.
+typedef std::vector<Value, ArenaAllocator<Value>> Row;
+typedef std::vector<Row *> Rows;
+
+// the ValueDict of a row whose values are in the order of column_names (freed by caller)
+ValueDict *to_value_dict(const ColumnNames &column_names, const Row &row);
+
+/**
+ * @class HandleIterator - streams the handles of a relation's qualifying rows one at a time
+ */
+class HandleIterator {
+  public:
+    virtual ~HandleIterator() {}
+
+    /**
+     * Advance to the next qualifying row.
+     * @param handle  set to the next row's handle
+     * @returns       false if there are no more rows
+     */
+    virtual bool next(Handle &handle) = 0;
+};
+
+/**
+ * @class RowIterator - streams a relation's qualifying rows (projected) one at a time
+ */
+class RowIterator {
+  public:
+    virtual ~RowIterator() {}
+
+    /**
+     * Advance to the next qualifying row.
+     * @param row  set to the next row's values, in the order of the columns asked for (freed by caller)
+     * @returns    false if there are no more rows
+     */
+    virtual bool next(Row *&row) = 0;
+};
+
+/**
+ * @class ValueRange - bounds on the values of a column, for range predicates
+ * (<, <=, >, >=, BETWEEN). Either end may be left open.
+ */
+class ValueRange {
+  public:
+    bool has_min;
+    bool min_inclusive;
+    Value min;
+    bool has_max;
+    bool max_inclusive;
+    Value max;
+
+    ValueRange() : has_min(false), min_inclusive(true), has_max(false), max_inclusive(true) {}
+
+    /**
+     * Tighten the lower bound (if value is more restrictive than what we have).
+     * @param value      new lower bound
+     * @param inclusive  true for >=, false for >
+     */
+    void restrict_min(const Value &value, bool inclusive);
+
+    /**
+     * Tighten the upper bound (if value is more restrictive than what we have).
+     * @param value      new upper bound
+     * @param inclusive  true for <=, false for <
+     */
+    void restrict_max(const Value &value, bool inclusive);
+
+    /**
+     * Check if a value falls within the bounds.
+     * @param value  value to check
+     * @returns      true if value is in range
+     */
+    bool contains(const Value &value) const;
+
+    /**
+     * Check if a TEXT value falls within the bounds, without making a Value of it.
+     * @param text  the value's bytes (not nul-terminated)
+     * @param size  number of bytes
+     * @returns     true if the value is in range
+     */
+    bool contains_text(const char *text, size_t size) const;
+};
+
+typedef std::map<Identifier, ValueRange> ValueRanges;
+
+class BatchScan;
+
 /**
  * @class DbRelationError - generic exception class for DbRelation
  */
@@ -282,8 +390,13 @@ class DbRelationError : public std::runtime_error {
  *	del(handle)
  *	select()
  *	select(where)
+ *	scan(where, ranges)
  *	project(handle)
  *	project(handle, column_names)
+ *	rows(column_names, where, ranges)
+ *	batches(column_names)
+ *	morsel_count(blocks_per_morsel)
+ *	batches(column_names, morsel, blocks_per_morsel)
  */
 class DbRelation {
   public:
@@ -373,6 +486,33 @@ class DbRelation {
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> AND <ranges>
+     * The default does the equality selection and then checks the ranges by projecting each row.
+     * @param where   equality predicates (may be nullptr)
+     * @param ranges  range predicates (may be nullptr)
+     * @returns       a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(const ValueDict *where, const ValueRanges *ranges);
+
+    /**
+     * Refine current_selection with both equality and range predicates.
+     * @param current_selection  restrict selection to be from these rows
+     * @param where              equality predicates (may be nullptr)
+     * @param ranges             range predicates (may be nullptr)
+     * @returns                  a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(Handles *current_selection, const ValueDict *where, const ValueRanges *ranges);
+
+    /**
+     * Like select(where, ranges), but streams the handles instead of collecting them all first.
+     * The default just walks the list from select(where, ranges).
+     * @param where   equality predicates (may be nullptr; must outlive the iterator)
+     * @param ranges  range predicates (may be nullptr; must outlive the iterator)
+     * @returns       an iterator over the handles of qualifying rows (freed by caller)
+     */
+    virtual HandleIterator *scan(const ValueDict *where = nullptr, const ValueRanges *ranges = nullptr);
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -409,6 +549,57 @@ class DbRelation {
 
     virtual ValueDicts *project(Handles *handles, const ValueDict *column_names);
 
+    /**
+     * Return the values given by column_names for each of a list of handles, by position.
+     * The default projects each as a ValueDict and lines its values up.
+     * @param handles       rows to get values from
+     * @param column_names  list of column names to project
+     * @param arena         where to keep the rows' values (the heap if nullptr)
+     * @returns             a row for each handle, its values in the order of column_names (freed by caller)
+     */
+    virtual Rows *project_rows(Handles *handles, const ColumnNames *column_names, QueryArena *arena = nullptr);
+
+    /**
+     * Stream the qualifying rows, projected to column_names: SELECT <column_names> WHERE <where> AND <ranges>.
+     * The default projects each handle from scan(where, ranges).
+     * @param column_names  list of column names to project
+     * @param where         equality predicates (may be nullptr; must outlive the iterator)
+     * @param ranges        range predicates (may be nullptr; must outlive the iterator)
+     * @param arena         where to keep the rows' values (the heap if nullptr; must outlive the rows)
+     * @returns             an iterator over the projected rows (freed by caller)
+     */
+    virtual RowIterator *rows(const ColumnNames *column_names, const ValueDict *where = nullptr,
+                              const ValueRanges *ranges = nullptr, QueryArena *arena = nullptr);
+
+    /**
+     * Scan all the rows a ColumnBatch at a time (for the vectorized executor).
+     * The default is to not support it.
+     * @param column_names  columns to load into each batch, in batch column order
+     * @returns             the batch scan (freed by caller), or nullptr if not supported
+     */
+    virtual BatchScan *batches(const ColumnNames *column_names) { return nullptr; }
+
+    /**
+     * Number of morsels (runs of blocks_per_morsel blocks) a batch scan of this
+     * relation can be split into, so they can be scanned in parallel.
+     * The default is 0: the relation can't be split.
+     * @param blocks_per_morsel  blocks in each morsel
+     * @returns                  number of morsels
+     */
+    virtual uint morsel_count(uint blocks_per_morsel) { return 0; }
+
+    /**
+     * Scan the rows of one morsel a ColumnBatch at a time. Scans of different
+     * morsels may run at the same time on different threads.
+     * @param column_names       columns to load into each batch, in batch column order
+     * @param morsel             which morsel (0 .. morsel_count() - 1)
+     * @param blocks_per_morsel  blocks in each morsel
+     * @returns                  the batch scan (freed by caller), or nullptr if not supported
+     */
+    virtual BatchScan *batches(const ColumnNames *column_names, uint morsel, uint blocks_per_morsel) {
+        return nullptr;
+    }
+
     /**
      * Accessor for column_names.
      * @returns column_names   list of column names for this relation, in order
@@ -445,6 +636,8 @@ class DbRelation {
     Identifier table_name;
     ColumnNames column_names;
     ColumnAttributes column_attributes;
+
+    Handles *in_ranges(Handles *handles, const ValueRanges *ranges);
 };
 
 class DbIndex {
@@ -499,19 +692,44 @@ class DbIndex {
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Check whether any record has the given search key (as a unique index
+     * must before taking another). The default does a lookup.
+     * @param key_values  dictionary of values for the search key
+     * @returns           true if lookup(key_values) would find anything
+     */
+    virtual bool contains(ValueDict *key_values) const;
+
     /**
      * Insert the index entry for the given record.
+     * The default projects the key columns and passes them on.
      * @param record  handle (into relation) to the record to insert
      *                (must be in the relation at time of insertion)
      */
-    virtual void insert(Handle record) = 0;
+    virtual void insert(Handle record);
+
+    /**
+     * Insert the index entry for a record whose values are already known,
+     * without reading it back from the relation.
+     * @param record  handle (into relation) to the record to insert
+     * @param row     the record's values (at least the key columns)
+     */
+    virtual void insert(Handle record, const ValueDict *row) = 0;
 
     /**
      * Delete the index entry for the given record.
+     * The default projects the key columns and passes them on.
      * @param record  handle (into relation) to the record to remove
      *                (must still be in the relation at time of removal)
      */
-    virtual void del(Handle record) = 0;
+    virtual void del(Handle record);
+
+    /**
+     * Delete the index entry for a record whose values are already known.
+     * @param record  handle (into relation) to the record to remove
+     * @param row     the record's values (at least the key columns)
+     */
+    virtual void del(Handle record, const ValueDict *row) = 0;
 
   protected:
     DbRelation &relation;
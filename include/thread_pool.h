@@ -0,0 +1,65 @@
+/**
+ * @file thread_pool.h - Fixed set of worker threads for running tasks in parallel.
+ * ThreadPool
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool - worker threads taking tasks from a shared queue
+ *
+ * Tasks run in the order submitted, each on whichever worker is free first.
+ * A task must not throw.
+ */
+class ThreadPool {
+  public:
+    /**
+     * The thread pool shared by all the queries, with one thread per core to start with.
+     * @return the pool
+     */
+    static ThreadPool &instance();
+
+    ThreadPool(uint thread_count);
+
+    virtual ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other) = delete;
+
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    /**
+     * Queue a task to be run by the next free worker.
+     * @param task  the task
+     */
+    virtual void submit(std::function<void()> task);
+
+    uint get_thread_count() const { return (uint) this->workers.size(); }
+
+    /**
+     * Change the number of workers. The tasks already submitted are finished first.
+     * @param thread_count  new number of workers (at least 1)
+     */
+    virtual void set_thread_count(uint thread_count);
+
+  protected:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping;
+
+    virtual void start(uint thread_count);
+
+    virtual void stop();
+
+    virtual void work();
+};
@@ -0,0 +1,218 @@
+/**
+ * @file batch_exec.cpp - implementation of the vectorized executor
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cstring>
+#include "batch_exec.h"
+
+using namespace std;
+
+// Keep the selected rows for which keep(row) is true. Written without a branch on keep, so the loop
+// runs at the same speed however selective the predicate is.
+template<typename Keep>
+static uint narrow(uint16_t *selection, uint selected, Keep keep) {
+    uint n = 0;
+    for (uint i = 0; i < selected; i++) {
+        uint16_t row = selection[i];
+        selection[n] = row;
+        n += keep(row) ? 1 : 0;
+    }
+    return n;
+}
+
+// Compare a TEXT value in the batch against s, like std::string::compare.
+static int compare_text(const ColumnVector *column, uint16_t row, const string &s) {
+    uint16_t length = column->lengths[row];
+    size_t common = min((size_t) length, s.size());
+    int cmp = common == 0 ? 0 : memcmp(column->text(row), s.data(), common);
+    if (cmp != 0)
+        return cmp;
+    return length < s.size() ? -1 : (length > s.size() ? 1 : 0);
+}
+
+void BatchPredicate::apply(ColumnBatch &batch) const {
+    const ColumnVector *vector = batch.columns[this->column];
+    uint16_t *selection = batch.selection;
+    uint selected = batch.selected;
+    const string &s = this->value.s;
+    switch (this->op) {
+        case IntFilter::EQ:
+            selected = narrow(selection, selected, [vector, &s](uint16_t row) {
+                return vector->lengths[row] == s.size() && compare_text(vector, row, s) == 0;
+            });
+            break;
+        case IntFilter::LT:
+            selected = narrow(selection, selected, [vector, &s](uint16_t row) {
+                return compare_text(vector, row, s) < 0;
+            });
+            break;
+        case IntFilter::LE:
+            selected = narrow(selection, selected, [vector, &s](uint16_t row) {
+                return compare_text(vector, row, s) <= 0;
+            });
+            break;
+        case IntFilter::GT:
+            selected = narrow(selection, selected, [vector, &s](uint16_t row) {
+                return compare_text(vector, row, s) > 0;
+            });
+            break;
+        case IntFilter::GE:
+            selected = narrow(selection, selected, [vector, &s](uint16_t row) {
+                return compare_text(vector, row, s) >= 0;
+            });
+            break;
+    }
+    batch.selected = selected;
+}
+
+void BatchPredicate::apply(const ColumnBatch &batch, uint64_t *mask) const {
+    IntFilter::filter(batch.columns[this->column]->ints.data(), batch.size, this->op, this->value.n, mask);
+}
+
+BatchExecutor *BatchExecutor::create(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                                     const ValueRanges *ranges, QueryArena *arena) {
+    // this also makes sure all the columns are in the table
+    ColumnNames needed = *projection;
+    if (where != nullptr)
+        for (auto const &predicate: *where)
+            needed.push_back(predicate.first);
+    if (ranges != nullptr)
+        for (auto const &range: *ranges)
+            needed.push_back(range.first);
+    BatchScan *probe = table.batches(&needed);
+    if (probe == nullptr)
+        return nullptr;
+    delete probe;
+    return new BatchExecutor(table, projection, where, ranges, arena);
+}
+
+BatchExecutor::BatchExecutor(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                             const ValueRanges *ranges, QueryArena *arena)
+        : table(table), projection(*projection), projection_columns(), batch_columns(), predicates(),
+          int_predicates(0), none(false), morsel(0), blocks_per_morsel(0), batch(nullptr), scan(nullptr), cursor(0),
+          arena(arena) {
+    for (auto const &column_name: this->projection)
+        this->projection_columns.push_back(batch_column(column_name));
+
+    // equality predicates
+    if (where != nullptr) {
+        for (auto const &predicate: *where) {
+            uint column = batch_column(predicate.first);
+            ColumnAttributes *attributes = table.get_column_attributes(ColumnNames(1, predicate.first));
+            bool same_type = (*attributes)[0].get_data_type() == predicate.second.data_type;
+            delete attributes;
+            if (same_type)
+                add_predicate(BatchPredicate(column, IntFilter::EQ, predicate.second));
+            else
+                this->none = true;  // no value of the column can equal it
+        }
+    }
+
+    // range predicates, one comparison for each end that is bounded
+    if (ranges != nullptr) {
+        for (auto const &range: *ranges) {
+            if (range.second.has_min)
+                add_bound(range.first, range.second.min_inclusive ? IntFilter::GE : IntFilter::GT,
+                          range.second.min, range.second);
+            if (range.second.has_max)
+                add_bound(range.first, range.second.max_inclusive ? IntFilter::LE : IntFilter::LT,
+                          range.second.max, range.second);
+        }
+    }
+}
+
+BatchExecutor::BatchExecutor(const BatchExecutor &other)
+        : table(other.table), projection(other.projection), projection_columns(other.projection_columns),
+          batch_columns(other.batch_columns), predicates(other.predicates), int_predicates(other.int_predicates),
+          none(other.none), morsel(other.morsel), blocks_per_morsel(other.blocks_per_morsel), batch(nullptr),
+          scan(nullptr), cursor(0), arena(other.arena) {
+}
+
+BatchExecutor::~BatchExecutor() {
+    close();
+}
+
+// Find (or add) the batch column for a table column.
+uint BatchExecutor::batch_column(const Identifier &column_name) {
+    for (uint i = 0; i < this->batch_columns.size(); i++)
+        if (this->batch_columns[i] == column_name)
+            return i;
+    this->batch_columns.push_back(column_name);
+    return (uint) this->batch_columns.size() - 1;
+}
+
+// Add a predicate, keeping the INT and BOOLEAN ones ahead of the TEXT ones.
+void BatchExecutor::add_predicate(const BatchPredicate &predicate) {
+    if (predicate.is_int())
+        this->predicates.insert(this->predicates.begin() + this->int_predicates++, predicate);
+    else
+        this->predicates.push_back(predicate);
+}
+
+// Add a comparison for one end of a range. A bound of another type than the column is either always or never
+// satisfied (values of different types are ordered by type alone), so it becomes no predicate or none at all.
+void BatchExecutor::add_bound(const Identifier &column_name, BatchPredicate::Op op, const Value &bound,
+                              const ValueRange &range) {
+    uint column = batch_column(column_name);
+    ColumnAttributes *attributes = this->table.get_column_attributes(ColumnNames(1, column_name));
+    Value sample;
+    sample.data_type = (*attributes)[0].get_data_type();
+    delete attributes;
+    if (sample.data_type == bound.data_type) {
+        add_predicate(BatchPredicate(column, op, bound));
+    } else {
+        ValueRange one_end;
+        if (op == IntFilter::GE || op == IntFilter::GT)
+            one_end.restrict_min(bound, range.min_inclusive);
+        else
+            one_end.restrict_max(bound, range.max_inclusive);
+        if (!one_end.contains(sample))
+            this->none = true;
+    }
+}
+
+void BatchExecutor::open() {
+    close();
+    ColumnAttributes *attributes = this->table.get_column_attributes(this->batch_columns);
+    this->batch = new ColumnBatch(*attributes);
+    delete attributes;
+    if (this->blocks_per_morsel == 0)
+        this->scan = this->table.batches(&this->batch_columns);
+    else
+        this->scan = this->table.batches(&this->batch_columns, this->morsel, this->blocks_per_morsel);
+    this->cursor = 0;
+}
+
+// Pull batches until one has a row that passes all the predicates, then hand its rows out one at a time.
+bool BatchExecutor::next(Row *&row) {
+    if (this->none)
+        return false;
+    while (this->cursor >= this->batch->selected) {
+        ColumnBatch &batch = *this->batch;
+        if (!this->scan->next(batch))
+            return false;
+        if (this->int_predicates > 0) {
+            IntFilter::set_all(this->mask, batch.size);
+            for (uint i = 0; i < this->int_predicates; i++)
+                this->predicates[i].apply(batch, this->mask);
+            batch.selected = IntFilter::to_selection(this->mask, batch.size, batch.selection);
+        }
+        for (uint i = this->int_predicates; i < this->predicates.size() && batch.selected > 0; i++)
+            this->predicates[i].apply(batch);
+        this->cursor = 0;
+    }
+    uint16_t position = this->batch->selection[this->cursor++];
+    row = new Row(ArenaAllocator<Value>(this->arena));
+    row->reserve(this->projection.size());
+    for (uint i = 0; i < this->projection.size(); i++)
+        row->push_back(this->batch->columns[this->projection_columns[i]]->get_value(position));
+    return true;
+}
+
+void BatchExecutor::close() {
+    delete this->scan;
+    this->scan = nullptr;
+    delete this->batch;
+    this->batch = nullptr;
+}
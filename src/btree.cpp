@@ -3,11 +3,150 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
+#include <algorithm>
+#include <cstdio>
+#include <queue>
 #include "btree.h"
+#include "btree_fixed.h"
+#include "schema_tables.h"
 
 // #define DEBUG_ENABLED
 #include "debug.h"
 
+typedef std::pair<KeyValue, Handle> BTreeEntry;
+
+/**
+ * @class BTreeEntrySorter - sorts (key, handle) entries, then hands them back in key order
+ *
+ * Up to run_size entries are sorted in memory. Past that, each full run is
+ * sorted and written to a temporary file, and the runs are merged as the
+ * entries are read back.
+ */
+class BTreeEntrySorter {
+public:
+    BTreeEntrySorter(const KeyProfile &key_profile, u_long run_size) : key_profile(key_profile), run_size(run_size),
+                                                                        run(), i(0), runs(), heads(),
+                                                                        merge(HeadAfter(&heads)) {}
+
+    virtual ~BTreeEntrySorter() {
+        for (auto file: runs)
+            fclose(file);
+    }
+
+    BTreeEntrySorter(const BTreeEntrySorter &other) = delete;
+
+    BTreeEntrySorter &operator=(const BTreeEntrySorter &other) = delete;
+
+    // Add an entry (taking the contents of key).
+    void add(KeyValue &key, Handle handle) {
+        run.push_back(BTreeEntry(std::move(key), handle));
+        if (run.size() >= run_size)
+            spill();
+    }
+
+    // Done adding; get ready to hand the entries back.
+    void sort() {
+        if (runs.empty()) {
+            std::sort(run.begin(), run.end());
+            return;
+        }
+        if (!run.empty())
+            spill();
+        heads.resize(runs.size());
+        for (uint k = 0; k < runs.size(); k++) {
+            rewind(runs[k]);
+            if (read(runs[k], heads[k]))
+                merge.push(k);
+        }
+    }
+
+    // Get the next entry in key order. Returns false when there are no more.
+    bool next(BTreeEntry &entry) {
+        if (runs.empty()) {
+            if (i >= run.size())
+                return false;
+            entry = std::move(run[i++]);
+            return true;
+        }
+        if (merge.empty())
+            return false;
+        uint k = merge.top();
+        merge.pop();
+        entry = std::move(heads[k]);
+        if (read(runs[k], heads[k]))
+            merge.push(k);
+        return true;
+    }
+
+protected:
+    // orders the runs in the merge by their next entry, smallest on top
+    struct HeadAfter {
+        const std::vector<BTreeEntry> *heads;
+
+        explicit HeadAfter(const std::vector<BTreeEntry> *heads) : heads(heads) {}
+
+        bool operator()(uint a, uint b) const { return (*heads)[b] < (*heads)[a]; }
+    };
+
+    const KeyProfile &key_profile;
+    u_long run_size;
+    std::vector<BTreeEntry> run;
+    u_long i;
+    std::vector<FILE *> runs;
+    std::vector<BTreeEntry> heads;  // next entry of each run
+    std::priority_queue<uint, std::vector<uint>, HeadAfter> merge;
+
+    void spill() {
+        std::sort(run.begin(), run.end());
+        FILE *file = tmpfile();
+        if (file == nullptr)
+            throw DbRelationError("cannot open a temporary file to sort index entries");
+        runs.push_back(file);
+        for (auto const &entry: run)
+            write(file, entry);
+        run.clear();
+    }
+
+    void write(FILE *file, const BTreeEntry &entry) {
+        bool ok = fwrite(&entry.second.first, sizeof(BlockID), 1, file) == 1 &&
+                  fwrite(&entry.second.second, sizeof(RecordID), 1, file) == 1;
+        for (uint col_num = 0; col_num < key_profile.size(); col_num++) {
+            const Value &value = entry.first[col_num];
+            if (key_profile[col_num] == ColumnAttribute::TEXT) {
+                uint16_t size = (uint16_t) value.s.length();
+                ok = ok && fwrite(&size, sizeof(size), 1, file) == 1 &&
+                     fwrite(value.s.data(), 1, size, file) == size;
+            } else {
+                ok = ok && fwrite(&value.n, sizeof(value.n), 1, file) == 1;
+            }
+        }
+        if (!ok)
+            throw DbRelationError("cannot write index entries to a temporary file");
+    }
+
+    bool read(FILE *file, BTreeEntry &entry) {
+        if (fread(&entry.second.first, sizeof(BlockID), 1, file) != 1)
+            return false;
+        bool ok = fread(&entry.second.second, sizeof(RecordID), 1, file) == 1;
+        entry.first.resize(key_profile.size());
+        for (uint col_num = 0; col_num < key_profile.size(); col_num++) {
+            Value &value = entry.first[col_num];
+            value.data_type = key_profile[col_num];
+            if (value.data_type == ColumnAttribute::TEXT) {
+                uint16_t size = 0;
+                ok = ok && fread(&size, sizeof(size), 1, file) == 1;
+                value.s.resize(size);
+                ok = ok && fread(&value.s[0], 1, size, file) == size;
+            } else {
+                ok = ok && fread(&value.n, sizeof(value.n), 1, file) == 1;
+            }
+        }
+        if (!ok)
+            throw DbRelationError("cannot read index entries back from a temporary file");
+        return true;
+    }
+};
+
 BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
                                                                                                               name,
                                                                                                               key_columns,
@@ -17,63 +156,247 @@ BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_co
                                                                                                       root(nullptr),
                                                                                                       file(relation.get_table_name() +
                                                                                                            "-" + name),
-                                                                                                      key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+                                                                                                      key_profile(),
+                                                                                                      fill_factor(
+                                                                                                              BTreeStat::DEFAULT_FILL_FACTOR),
+                                                                                                      sort_run(
+                                                                                                              DEFAULT_SORT_RUN) {
     build_key_profile();
 }
 
+BTreeIndex *BTreeIndex::make(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) {
+    if (unique && key_columns.size() == 1) {
+        const ColumnNames &column_names = relation.get_column_names();
+        ColumnAttributes column_attributes = relation.get_column_attributes();
+        for (uint col_num = 0; col_num < column_names.size(); col_num++) {
+            if (column_names[col_num] != key_columns[0])
+                continue;
+            if (column_attributes[col_num].get_data_type() == ColumnAttribute::INT)
+                return new BTreeFixedIndex<int32_t>(relation, name, key_columns, unique);
+            if (column_attributes[col_num].get_data_type() == ColumnAttribute::BOOLEAN)
+                return new BTreeFixedIndex<uint8_t>(relation, name, key_columns, unique);
+        }
+    }
+    return new BTreeIndex(relation, name, key_columns, unique);
+}
+
 BTreeIndex::~BTreeIndex() {
+    BTreeNodeCache::instance().forget(file);
     delete stat;
     delete root;
 }
 
-// Create the index.
+// Create the index. All the keys are pulled out of the relation in one scan and sorted, then the leaves are
+// written left to right and each level of interior nodes above them, up to the root.
 void BTreeIndex::create() {
     DEBUG_OUT("BTreeIndex::create() - begin\n");
     file.create();
-    stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
+    stat = new BTreeStat(file, STAT, STAT + 1, key_profile, fill_factor);
     closed = false;
-    Handles *table_rows = relation.select();
+    BTreeEntrySorter sorter(key_profile, sort_run);
     try {
         DEBUG_OUT("BTreeIndex::create() - try\n");
-        for (auto const &row: *table_rows) {
-            insert(row);
-        }
+        for_each_key([&sorter](KeyValue &key, Handle handle) { sorter.add(key, handle); });
+        sorter.sort();
+        build(sorter);
     } catch (...) {
         DEBUG_OUT("BTreeIndex::create() - catch\n");
         drop();
         throw;
     }
-    delete table_rows;
     DEBUG_OUT("BTreeIndex::create() - end\n");
 }
 
+// Scan the relation, projecting the keys a chunk of handles at a time so each block is only read once per chunk.
+void BTreeIndex::for_each_key(std::function<void(KeyValue &key, Handle handle)> add) {
+    const u_long CHUNK = 1024;
+    HandleIterator *handles = relation.scan();
+    try {
+        Handles chunk;
+        Handle handle;
+        bool more = true;
+        while (more) {
+            more = handles->next(handle);
+            if (more)
+                chunk.push_back(handle);
+            if (chunk.size() == CHUNK || (!more && !chunk.empty())) {
+                ValueDicts *rows = relation.project(&chunk, &key_columns);
+                for (u_long j = 0; j < chunk.size(); j++) {
+                    KeyValue *key = tkey((*rows)[j]);
+                    add(*key, chunk[j]);
+                    delete key;
+                    delete (*rows)[j];
+                }
+                delete rows;
+                chunk.clear();
+            }
+        }
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    delete handles;
+}
+
+void BTreeIndex::set_fill_factor(uint fill_factor) {
+    if (fill_factor < 10 || fill_factor > 100)
+        throw DbRelationError("fill factor must be from 10 to 100");
+    this->fill_factor = fill_factor;
+}
+
+// What a node's records cost in its SlottedPage: 4 bytes of block header, plus 4 bytes of record header for each
+// record. A block can hold up to BLOCK_SZ - 1 bytes of that.
+static const u_long PAGE_HEADER = 4;
+static const u_long RECORD_HEADER = 4;
+static const u_long PAGE_CAPACITY = DbBlock::BLOCK_SZ - 1;
+
+// Write the leaves from the sorted entries, filling each to fill_factor, then the interior levels above them.
+// A leaf's entries are gathered until the next one would overfill it (allowing for the prefix they share), and
+// each leaf's boundary is cut down to the least that separates it from the leaf before.
+void BTreeIndex::build(BTreeEntrySorter &sorter) {
+    const u_long fill_bytes = PAGE_CAPACITY * this->fill_factor / 100;
+
+    Level leaves;
+    BTreeLeaf *leaf = new BTreeLeaf(file, 0, key_profile, true);
+    try {
+        leaves.push_back(std::make_pair(std::string(), leaf->get_id()));
+        LeafEntries entries;
+        std::string previous;
+        BTreeEntry entry;
+        u_long count = 0;
+        while (sorter.next(entry)) {
+            std::string normalized = entry_key(&entry.first, entry.second);
+            if (count > 0 && normalized == previous)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+            if (normalized.size() > BTreeLeaf::MAX_KEY_SZ)
+                throw DbRelationError("index key too big to marshal");
+            entries.push_back(LeafEntry(entry.second, normalized));
+            if (entries.size() > 1 && BTreeLeaf::bytes_needed(entries, 0, entries.size()) > fill_bytes) {
+                BTreeLeaf *next = new BTreeLeaf(file, 0, key_profile, true);
+                leaf->set_next_leaf(next->get_id());
+                leaf->put_entries(entries, 0, entries.size() - 1);
+                leaf->save();
+                delete leaf;
+                leaf = next;
+                leaves.push_back(std::make_pair(BTreeLeaf::separator(previous, normalized), leaf->get_id()));
+                entries.erase(entries.begin(), entries.end() - 1);
+            }
+            previous = std::move(normalized);
+            count++;
+        }
+        leaf->put_entries(entries, 0, entries.size());
+        leaf->save();
+    } catch (...) {
+        delete leaf;
+        throw;
+    }
+    delete leaf;
+
+    uint height = 1;
+    Level level = leaves;
+    while (level.size() > 1) {
+        level = build_interior_level(level);
+        height++;
+    }
+    stat->set_root_id(level[0].second);
+    stat->set_height(height);
+    stat->save();
+    delete root;
+    if (height == 1)
+        root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
+    else
+        root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
+}
+
+// Write the interior nodes over the given level, filling each to fill_factor. Returns the level they make.
+BTreeIndex::Level BTreeIndex::build_interior_level(const Level &below) {
+    const u_long fill_bytes = PAGE_CAPACITY * this->fill_factor / 100;
+    const u_long interior_base = PAGE_HEADER + sizeof(BlockID) + RECORD_HEADER;  // the first pointer
+    const u_long pointer_bytes = sizeof(BlockID) + RECORD_HEADER;
+
+    Level level;
+    BTreeInterior *node = new BTreeInterior(file, 0, key_profile, true);
+    try {
+        node->set_first(below[0].second);
+        level.push_back(std::make_pair(below[0].first, node->get_id()));
+        u_long used = interior_base, count = 0;
+        for (u_long j = 1; j < below.size(); j++) {
+            u_long bytes = below[j].first.size() + RECORD_HEADER + pointer_bytes;
+            if (count > 0 && used + bytes > fill_bytes) {
+                node->save();
+                delete node;
+                node = new BTreeInterior(file, 0, key_profile, true);
+                node->set_first(below[j].second);
+                level.push_back(std::make_pair(below[j].first, node->get_id()));
+                used = interior_base;
+                count = 0;
+                continue;
+            }
+            node->append(below[j].first, below[j].second);
+            used += bytes;
+            count++;
+        }
+        node->save();
+    } catch (...) {
+        delete node;
+        throw;
+    }
+    delete node;
+    return level;
+}
+
 // Drop the index.
 void BTreeIndex::drop() {
     DEBUG_OUT("BTreeIndex::drop() - begin\n");
+    BTreeNodeCache::instance().forget(file);
     file.drop();
     DEBUG_OUT("BTreeIndex::drop() - end\n");
 }
 
-// Open existing index. Enables: lookup, range, insert, delete, update.
+// Open existing index. Enables: lookup, range, insert, delete, update. An index built with an older key format
+// is rebuilt first.
 void BTreeIndex::open() {
     if (closed) {
         file.open();
         stat = new BTreeStat(file, STAT, key_profile);
+        fill_factor = stat->get_fill_factor();
+        if (outdated(stat->get_key_format())) {
+            rebuild();
+            return;
+        }
         delete root;
-        if (stat->get_height() == 1)
-            root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-        else
-            root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        root = nullptr;
+        read_root();
+        closed = false;
     }
 }
 
+void BTreeIndex::read_root() {
+    if (stat->get_key_format() == BTreeStat::FIXED_KEYS)
+        throw DbRelationError("index " + name + " has fixed-width key nodes; open it with BTreeIndex::make");
+    if (stat->get_height() == 1)
+        root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
+    else
+        root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
+}
+
+// The nodes can't be read, but the relation still has every key: drop the file and build it again (keeping its
+// fill factor), which takes one scan and a bulk load.
+void BTreeIndex::rebuild() {
+    BTreeNodeCache::instance().forget(file);
+    delete stat;
+    stat = nullptr;
+    delete root;
+    root = nullptr;
+    file.drop();
+    closed = true;
+    create();
+}
+
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
     if (!closed) {
+        BTreeNodeCache::instance().forget(file);
         file.close();
         delete stat;
         stat = nullptr;
@@ -83,16 +406,44 @@ void BTreeIndex::close() {
     }
 }
 
+// In a non-unique index each entry's key ends with its handle: block id and record id, big-endian so the entries
+// for one key sort by handle. All of them lie between the key alone and the key followed by HANDLE_MAX.
+static const std::string HANDLE_MAX(sizeof(BlockID) + sizeof(RecordID), (char) 0xFF);
+
+std::string BTreeIndex::normalized(const ValueDict *key) const {
+    KeyValue *t_key = tkey(key);
+    std::string bytes = BTreeNode::normalize_key(key_profile, t_key);
+    delete t_key;
+    return bytes;
+}
+
+std::string BTreeIndex::entry_key(const KeyValue *key, Handle handle) const {
+    std::string bytes = BTreeNode::normalize_key(key_profile, key);
+    if (!unique) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            bytes += (char) (handle.first >> shift);
+        bytes += (char) (handle.second >> 8);
+        bytes += (char) handle.second;
+    }
+    return bytes;
+}
+
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    auto t_key = tkey(key_dict);
-    auto ret = _lookup(root, stat->get_height(), t_key);
-    delete t_key;
+    std::string key = normalized(key_dict);
+    Handles *ret;
+    if (unique) {
+        ret = _lookup(root, stat->get_height(), key);
+    } else {
+        std::string max_key = key + HANDLE_MAX;
+        ret = scan(&key, &max_key);
+    }
+    BTreeNodeCache::instance().trim();
     return ret;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
+Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const std::string &key) const {
     if (height == 1) {
         auto *leaf = dynamic_cast<BTreeLeaf *>(node);
         Handles *handles = new Handles();
@@ -103,28 +454,56 @@ Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key)
         return handles;
     } else {
         auto *interior = dynamic_cast<BTreeInterior *>(node);
-        auto n = interior->find(key, height);
+        auto n = interior->find(&key, height);
         auto ret = _lookup(n, height - 1, key);
-        delete n;
+        if (height == 2)
+            delete n;  // interior nodes belong to the node cache
         return ret;
     }
 }
 
+// Find all the rows whose keys are between min_key and max_key (inclusive). Either may be null for an open end.
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+    std::string t_min = min_key == nullptr ? std::string() : normalized(min_key);
+    std::string t_max = max_key == nullptr ? std::string() : normalized(max_key);
+    if (!unique)
+        t_max += HANDLE_MAX;
+    Handles *handles = scan(min_key == nullptr ? nullptr : &t_min, max_key == nullptr ? nullptr : &t_max);
+    BTreeNodeCache::instance().trim();
+    return handles;
+}
+
+// Descends once to the leaf where min_key would be, then walks the leaf chain until passing max_key.
+Handles *BTreeIndex::scan(const std::string *min_key, const std::string *max_key) const {
+    Handles *handles = new Handles();
+    BTreeNode *node = root;
+    for (uint height = stat->get_height(); height > 1; height--) {
+        auto *interior = dynamic_cast<BTreeInterior *>(node);
+        node = interior->find(min_key, height);  // cached, unless it's the leaf
+    }
+    auto *leaf = dynamic_cast<BTreeLeaf *>(node);
+    while (leaf->find_range(min_key, max_key, handles) && leaf->get_next_leaf() != 0) {
+        BTreeLeaf *next_leaf = leaf->next();
+        if (leaf != root)
+            delete leaf;
+        leaf = next_leaf;
+    }
+    if (leaf != root)
+        delete leaf;
+    return handles;
 }
 
-// Insert a row with the given handle. Row must exist in relation already.
-void BTreeIndex::insert(Handle handle) {
+// Insert the entry for the row with the given handle and values. Row must exist in relation already.
+void BTreeIndex::insert(Handle handle, const ValueDict *row) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
+    KeyValue *tkey = this->tkey(row);
+    std::string t_key = entry_key(tkey, handle);
+    delete tkey;
+    Insertion insertion = _insert(root, stat->get_height(), t_key, handle, true);
     if (!BTreeNode::insertion_is_none(insertion)) {
         auto *new_root = new BTreeInterior(file, 0, key_profile, true);
         new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
+        new_root->insert(insertion.second, insertion.first);
         new_root->save();
         stat->set_root_id(new_root->get_id());
         stat->set_height(stat->get_height() + 1);
@@ -133,35 +512,96 @@ void BTreeIndex::insert(Handle handle) {
         root = new_root;
         std::cout << "new root: " << *new_root << std::endl;
     }
-    delete key;
-    delete tkey;
+    BTreeNodeCache::instance().trim();
 }
 
 // Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
+// rightmost says whether node is at the right edge of its level.
+Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const std::string &key, Handle handle, bool rightmost) {
     if (height == 1) {
         auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
+        return leaf->insert(key, handle, stat->get_fill_factor());
     } else {
         auto *interior = dynamic_cast<BTreeInterior *>(node);
-        auto n = interior->find(key, height);
-        Insertion insertion = _insert(n, height - 1, key, handle);
-        delete n;
+        auto n = interior->find(&key, height);
+        bool n_rightmost = rightmost && n->get_id() == interior->get_last();
+        Insertion insertion;
+        try {
+            insertion = _insert(n, height - 1, key, handle, n_rightmost);
+        } catch (...) {
+            if (height == 2)
+                delete n;
+            throw;
+        }
+        if (height == 2)
+            delete n;  // interior nodes belong to the node cache
         if (!BTreeNode::insertion_is_none(insertion))
-            insertion = interior->insert(&insertion.second, insertion.first);
+            insertion = interior->insert(insertion.second, insertion.first, rightmost, stat->get_fill_factor());
         return insertion;
     }
 }
 
-void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+// Delete the entry for the row with the given handle and values. Row must still be in the relation.
+void BTreeIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    KeyValue *tkey = this->tkey(row);
+    std::string t_key = entry_key(tkey, handle);
+    delete tkey;
+    _del(root, stat->get_height(), t_key, handle);
+
+    // if merges have left the root with just one child, that child becomes the root
+    while (stat->get_height() > 1) {
+        auto *interior = dynamic_cast<BTreeInterior *>(root);
+        if (!interior->is_pass_through())
+            break;
+        BlockID new_root_id = interior->get_first();
+        BTreeNodeCache::instance().forget(file, new_root_id);  // the root is held here, not in the cache
+        stat->set_height(stat->get_height() - 1);
+        stat->set_root_id(new_root_id);
+        stat->save();
+        delete root;
+        if (stat->get_height() == 1)
+            root = new BTreeLeaf(file, new_root_id, key_profile, false);
+        else
+            root = new BTreeInterior(file, new_root_id, key_profile, false);
+    }
+    BTreeNodeCache::instance().trim();
+}
+
+// Recursive delete. Returns true if node has underflowed, so its parent can try to merge it with a sibling.
+bool BTreeIndex::_del(BTreeNode *node, uint height, const std::string &key, Handle handle) {
+    if (height == 1) {
+        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
+        return leaf->del(key, handle);
+    } else {
+        auto *interior = dynamic_cast<BTreeInterior *>(node);
+        auto n = interior->find(&key, height);
+        bool underflow;
+        try {
+            underflow = _del(n, height - 1, key, handle);
+            if (underflow && height == 2)
+                interior->merge_leaf(dynamic_cast<BTreeLeaf *>(n));
+        } catch (...) {
+            if (height == 2)
+                delete n;
+            throw;
+        }
+        if (height == 2)
+            delete n;  // interior nodes belong to the node cache
+        return false;
+    }
 }
 
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     KeyValue *key_value = new KeyValue();
-    for (auto const &column_name: key_columns)
-        key_value->push_back(key->find(column_name)->second);
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end()) {
+            delete key_value;
+            throw DbRelationError("missing key column " + column_name + " for index " + name);
+        }
+        key_value->push_back(column->second);
+    }
     return key_value;
 }
 
@@ -206,6 +646,283 @@ bool test_btree() {
     index.create();
     // return true;  // FIXME
 
+    // a descending key, sorted in spilled runs, into full blocks
+    ColumnNames b_column(1, "b");
+    BTreeIndex b_index(table, "barindex", b_column, true);
+    b_index.set_sort_run(7000);
+    b_index.set_fill_factor(100);
+    b_index.create();
+    ValueDict b_min, b_max;
+    b_min["b"] = -99999;
+    b_max["b"] = 101;
+    Handles *b_handles = b_index.range(&b_min, &b_max);
+    bool b_ok = b_handles->size() == 100 * 1000 + 2;
+    for (u_long i = 1; b_ok && i < b_handles->size(); i++) {
+        ValueDict *before = table.project((*b_handles)[i - 1], &b_column);
+        ValueDict *after = table.project((*b_handles)[i], &b_column);
+        b_ok = (*before)["b"].n < (*after)["b"].n;
+        delete before;
+        delete after;
+    }
+    delete b_handles;
+
+    // the interior levels are read once, then come from the node cache
+    BTreeNodeCache::instance().reset_counters();
+    for (int i = 0; b_ok && i < 1000; i++) {
+        ValueDict b_key;
+        b_key["b"] = -i * 97;
+        b_handles = b_index.lookup(&b_key);
+        b_ok = b_handles->size() == 1;
+        delete b_handles;
+    }
+    b_ok = b_ok && BTreeNodeCache::instance().get_misses() < 10 &&
+           BTreeNodeCache::instance().get_hits() + BTreeNodeCache::instance().get_misses() == 1000;
+
+    // an index left from before normalized keys is rebuilt when it is opened, keeping its fill factor
+    b_index.stat->set_key_format(BTreeStat::LEGACY_KEYS);
+    b_index.stat->save();
+    b_index.close();
+    b_index.open();
+    b_ok = b_ok && b_index.stat->get_key_format() == BTreeStat::NORMALIZED_KEYS && b_index.fill_factor == 100;
+    b_index.close();
+    b_index.open();
+    ValueDict b_key;
+    b_key["b"] = -12345;
+    b_handles = b_index.lookup(&b_key);
+    b_ok = b_ok && b_handles->size() == 1;
+    delete b_handles;
+    b_index.drop();
+    b_ok = b_ok && BTreeNodeCache::instance().size() == 0;
+    if (!b_ok) {
+        std::cout << "bulk load with external sort failed" << std::endl;
+        return false;
+    }
+
+    // duplicate keys can't make a unique index
+    ValueDict duplicate;
+    duplicate["a"] = 1;
+    duplicate["b"] = 99;
+    Handle duplicate_handle = table.insert(&duplicate);
+    BTreeIndex dup_index(table, "dupindex", b_column, true);
+    bool rejected = false;
+    try {
+        dup_index.create();
+    } catch (DbRelationError &e) {
+        rejected = true;
+    }
+    table.del(duplicate_handle);
+    if (!rejected) {
+        std::cout << "duplicate keys not rejected" << std::endl;
+        return false;
+    }
+    std::cout << "bulk load passed" << std::endl;
+
+    // growing keys split 90/10 at the right edge; shrinking ones still split evenly (and in order) at the left
+    HeapTable append_table("__test_btree_append", column_names, ColumnAttributes(1, ColumnAttribute(ColumnAttribute::INT)));
+    append_table.create();
+    BTreeIndex append_index(append_table, "appendindex", column_names, true);
+    append_index.create();
+    const int appends = 20 * 1000;
+    for (int i = 0; i < appends; i++) {
+        ValueDict append_row;
+        append_row["a"] = i;
+        append_index.insert(append_table.insert(&append_row));
+    }
+    // 18 bytes an entry, about 226 to a block, so an even split would leave about 113 in each leaf
+    BlockID append_blocks = append_index.file.get_last_block_id();
+    for (int i = -1; i >= -2000; i--) {
+        ValueDict append_row;
+        append_row["a"] = i;
+        append_index.insert(append_table.insert(&append_row));
+    }
+    bool append_ok = append_blocks < appends / 180;
+    ValueDict append_lookup;
+    for (int i = -2000; append_ok && i < appends; i += 3) {
+        append_lookup["a"] = i;
+        Handles *append_handles = append_index.lookup(&append_lookup);
+        append_ok = append_handles->size() == 1;
+        delete append_handles;
+    }
+    append_index.drop();
+    append_table.drop();
+    if (!append_ok) {
+        std::cout << "appends failed: " << append_blocks << " blocks" << std::endl;
+        return false;
+    }
+    std::cout << "appends passed" << std::endl;
+
+    // composite keys come back in KeyValue order from their normalized bytes: negative ints, empty strings, and
+    // strings that begin others
+    ColumnNames composite_columns;
+    composite_columns.push_back("s");
+    composite_columns.push_back("n");
+    ColumnAttributes composite_attributes;
+    composite_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    composite_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable composite_table("__test_btree_composite", composite_columns, composite_attributes);
+    composite_table.create();
+    const std::string strings[] = {"", "a", "a ", "ab", "abc", "b", "\x7f", "\xff"};
+    const int32_t numbers[] = {INT32_MIN, -70000, -1, 0, 1, 256, INT32_MAX};
+    std::vector<KeyValue> composite_keys;
+    for (auto const &str: strings) {
+        for (auto n: numbers) {
+            ValueDict composite_row;
+            composite_row["s"] = Value(str);
+            composite_row["n"] = Value(n);
+            composite_table.insert(&composite_row);
+            composite_keys.push_back(KeyValue{Value(str), Value(n)});
+        }
+    }
+    BTreeIndex composite_index(composite_table, "compositeindex", composite_columns, true);
+    composite_index.create();
+    std::sort(composite_keys.begin(), composite_keys.end());
+    Handles *composite_handles = composite_index.range(nullptr, nullptr);
+    bool composite_ok = composite_handles->size() == composite_keys.size();
+    for (u_long i = 0; composite_ok && i < composite_handles->size(); i++) {
+        ValueDict *composite_row = composite_table.project((*composite_handles)[i], &composite_columns);
+        composite_ok = (*composite_row)["s"] == composite_keys[i][0] && (*composite_row)["n"] == composite_keys[i][1];
+        delete composite_row;
+    }
+    delete composite_handles;
+    for (u_long i = 0; composite_ok && i < composite_keys.size(); i++) {
+        ValueDict composite_key;
+        composite_key["s"] = composite_keys[i][0];
+        composite_key["n"] = composite_keys[i][1];
+        composite_handles = composite_index.lookup(&composite_key);
+        composite_ok = composite_handles->size() == 1;
+        delete composite_handles;
+    }
+
+    // the heap can't keep a zero byte in TEXT, but the encoding escapes one in place
+    composite_keys.clear();
+    for (auto const &str: {std::string(), std::string("a"), std::string("a\0", 2), std::string("a\0\0", 3),
+                           std::string("a\0\x01", 3), std::string("a\x01"), std::string("a\xff")})
+        composite_keys.push_back(KeyValue{Value(str), Value(0)});
+    for (u_long i = 1; composite_ok && i < composite_keys.size(); i++)
+        composite_ok = BTreeNode::normalize_key(composite_index.key_profile, &composite_keys[i - 1]) <
+                       BTreeNode::normalize_key(composite_index.key_profile, &composite_keys[i]);
+
+    // a key value of another type than its column has no encoding
+    KeyValue swapped_key{Value(0), Value(std::string("s"))};
+    try {
+        BTreeNode::normalize_key(composite_index.key_profile, &swapped_key);
+        composite_ok = false;
+    } catch (DbRelationError &e) {
+    }
+    composite_index.drop();
+    composite_table.drop();
+    if (!composite_ok) {
+        std::cout << "composite keys failed" << std::endl;
+        return false;
+    }
+    std::cout << "composite keys passed" << std::endl;
+
+    // TEXT keys with a long common start: leaves keep it once as their prefix, and boundaries are cut short
+    ColumnNames url_column(1, "url");
+    HeapTable url_table("__test_btree_url", url_column, ColumnAttributes(1, ColumnAttribute(ColumnAttribute::TEXT)));
+    url_table.create();
+    const int urls = 20 * 1000;
+    auto url = [](int i) {
+        std::string digits = std::to_string(i * 7 % urls);
+        return "http://www.example.com/users/" + std::string(6 - digits.size(), '0') + digits + "/profile";
+    };
+    Handles url_handles;
+    for (int i = 0; i < urls / 2; i++) {
+        ValueDict url_row;
+        url_row["url"] = Value(url(i));
+        url_handles.push_back(url_table.insert(&url_row));
+    }
+    BTreeIndex url_index(url_table, "urlindex", url_column, true);
+    url_index.set_fill_factor(100);
+    url_index.create();
+    for (int i = urls / 2; i < urls; i++) {
+        ValueDict url_row;
+        url_row["url"] = Value(url(i));
+        url_handles.push_back(url_table.insert(&url_row));
+        url_index.insert(url_handles.back());
+    }
+    // 46 normalized bytes apiece in full would be 64 with a handle and headers, under 64 entries to a block
+    BlockID url_blocks = url_index.file.get_last_block_id();
+    bool url_ok = url_blocks < urls / 64;
+    ValueDict url_key;
+    for (int i = 0; url_ok && i < urls; i += 13) {
+        url_key["url"] = Value(url(i));
+        Handles *found = url_index.lookup(&url_key);
+        url_ok = found->size() == 1 && (*found)[0] == url_handles[i];
+        delete found;
+    }
+    ValueDict url_min, url_max;
+    url_min["url"] = Value("http://www.example.com/users/001000");
+    url_max["url"] = Value("http://www.example.com/users/002000");
+    Handles *url_range = url_index.range(&url_min, &url_max);
+    url_ok = url_ok && url_range->size() == 1000;
+    delete url_range;
+    for (int i = 0; url_ok && i < urls; i += 2)
+        url_index.del(url_handles[i]);
+    url_range = url_index.range(nullptr, nullptr);
+    url_ok = url_ok && url_range->size() == urls / 2;
+    delete url_range;
+    url_index.drop();
+    url_table.drop();
+    if (!url_ok) {
+        std::cout << "prefix compression failed: " << url_blocks << " blocks" << std::endl;
+        return false;
+    }
+    std::cout << "prefix compression passed" << std::endl;
+
+    // a non-unique index: many rows per key, before and after it is created, in handle order
+    HeapTable dup_table("__test_btree_dup", column_names, ColumnAttributes(1, ColumnAttribute(ColumnAttribute::INT)));
+    dup_table.create();
+    const int dup_keys = 50, dup_rows = 6000;
+    Handles dup_handles;
+    for (int i = 0; i < dup_rows; i++) {
+        ValueDict dup_row;
+        dup_row["a"] = i % dup_keys - dup_keys / 2;
+        dup_handles.push_back(dup_table.insert(&dup_row));
+        if (i == dup_rows / 2)
+            break;
+    }
+    BTreeIndex *multi_index = BTreeIndex::make(dup_table, "multiindex", column_names, false);
+    multi_index->create();
+    for (int i = (int) dup_handles.size(); i < dup_rows; i++) {
+        ValueDict dup_row;
+        dup_row["a"] = i % dup_keys - dup_keys / 2;
+        dup_handles.push_back(dup_table.insert(&dup_row));
+        multi_index->insert(dup_handles.back());
+    }
+    bool dup_ok = true;
+    ValueDict dup_key;
+    for (int k = -dup_keys / 2 - 1; dup_ok && k <= dup_keys / 2; k++) {
+        dup_key["a"] = k;
+        Handles *found = multi_index->lookup(&dup_key);
+        bool in_range = k >= -dup_keys / 2 && k < dup_keys / 2;
+        dup_ok = found->size() == (in_range ? (u_long) dup_rows / dup_keys : 0UL);
+        for (u_long i = 1; dup_ok && i < found->size(); i++)
+            dup_ok = (*found)[i - 1] < (*found)[i];
+        delete found;
+    }
+    ValueDict dup_min, dup_max;
+    dup_min["a"] = -2;
+    dup_max["a"] = 2;
+    Handles *dup_range = multi_index->range(&dup_min, &dup_max);
+    dup_ok = dup_ok && dup_range->size() == 5UL * dup_rows / dup_keys;
+    delete dup_range;
+    for (int i = 0; dup_ok && i < dup_rows; i++)
+        if (i / dup_keys % 2 == 0)
+            multi_index->del(dup_handles[i]);
+    dup_key["a"] = 0;
+    Handles *found = multi_index->lookup(&dup_key);
+    dup_ok = dup_ok && found->size() == (u_long) dup_rows / dup_keys / 2;
+    delete found;
+    multi_index->drop();
+    delete multi_index;
+    dup_table.drop();
+    if (!dup_ok) {
+        std::cout << "non-unique index failed" << std::endl;
+        return false;
+    }
+    std::cout << "non-unique index passed" << std::endl;
+
 
     ValueDict lookup;
     lookup["a"] = 12;
@@ -252,10 +969,6 @@ bool test_btree() {
             delete result;
         }
     std::cout << "all lookups passed" << std::endl;
-    
-    index.drop();
-    table.drop();
-    return true;
 
     // test delete
     ValueDict row;
@@ -282,6 +995,27 @@ bool test_btree() {
     }
     delete handles;
 
+    // delete enough to force leaf merges, then make sure everything else is still there
+    for (int i = 1000; i < 20 * 1000; i++) {
+        lookup["a"] = i + 100;
+        handles = index.lookup(&lookup);
+        thandle = handles->back();
+        delete handles;
+        index.del(thandle);
+        table.del(thandle);
+    }
+    for (int i = 0; i < 30 * 1000; i += 7) {
+        lookup["a"] = i + 100;
+        handles = index.lookup(&lookup);
+        bool deleted = i >= 1000 && i < 20 * 1000;
+        if (handles->size() != (deleted ? 0 : 1)) {
+            std::cout << "lookup after deletes failed " << i << std::endl;
+            return false;
+        }
+        delete handles;
+    }
+    std::cout << "deletes passed" << std::endl;
+
     // test range
     ValueDict minkey, maxkey;
     minkey["a"] = 100;
@@ -300,6 +1034,7 @@ bool test_btree() {
     for (auto vd: *results)
         delete vd;
     delete results;
+    std::cout << "range passed" << std::endl;
 
     // test range from beginning and to end
     handles = index.range(nullptr, nullptr);
@@ -321,8 +1056,15 @@ bool test_btree() {
         std::cout << "delete everything failed: " << count_i << std::endl;
         return false;
     }
+    std::cout << "full range and delete everything passed" << std::endl;
     index.drop();
     table.drop();
+    if (!test_btree_fixed())
+        return false;
+    std::cout << "fixed-width key index passed" << std::endl;
+    if (!test_unique_probe())
+        return false;
+    std::cout << "unique probe of an unopened index passed" << std::endl;
     return true;
 }
 
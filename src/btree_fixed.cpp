@@ -0,0 +1,719 @@
+/**
+ * @file btree_fixed.cpp - implementation of BTreeFixedIndex and its nodes
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <cstring>
+#include "btree_fixed.h"
+#include "heap_table.h"
+
+using namespace std;
+
+/******************
+ * BTreeFixedNode *
+ ******************/
+
+template<typename K>
+BTreeFixedNode<K>::BTreeFixedNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create)
+        : BTreeNode(file, block_id, key_profile, create), record(nullptr) {
+    static_assert(sizeof(Header) == HEADER_SZ, "fixed-width node header must be 8 bytes");
+    if (create) {
+        char blank[RECORD_SZ];
+        memset(blank, 0, RECORD_SZ);
+        Dbt dbt(blank, RECORD_SZ);
+        this->block->add(&dbt);
+    }
+    u_int16_t size = 0;
+    this->record = (char *) this->block->get_bytes(1, size);
+    if (this->record == nullptr || size != RECORD_SZ)
+        throw DbRelationError("block " + to_string(this->id) + " is not a fixed-width B-tree node");
+}
+
+// Binary search where each step picks the half to keep with a select, not a branch, so it doesn't mispredict.
+template<typename K>
+uint BTreeFixedNode<K>::search(const K *keys, uint n, K key, bool upper) {
+    if (n == 0)
+        return 0;
+    const K *base = keys;
+    if (upper) {
+        while (n > 1) {
+            uint half = n / 2;
+            base = key < base[half] ? base : base + half;
+            n -= half;
+        }
+        return (uint) (base - keys) + !(key < *base);
+    }
+    while (n > 1) {
+        uint half = n / 2;
+        base = base[half] < key ? base + half : base;
+        n -= half;
+    }
+    return (uint) (base - keys) + (*base < key);
+}
+
+
+/******************
+ * BTreeFixedLeaf *
+ ******************/
+
+template<typename K>
+BTreeFixedLeaf<K>::BTreeFixedLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create)
+        : BTreeFixedNode<K>(file, block_id, key_profile, create) {
+}
+
+template<typename K>
+Handle BTreeFixedLeaf<K>::handle_at(uint i) const {
+    Handle handle;
+    const char *slot = handle_slot(i);
+    memcpy(&handle.first, slot, sizeof(BlockID));
+    memcpy(&handle.second, slot + sizeof(BlockID), sizeof(RecordID));
+    return handle;
+}
+
+template<typename K>
+void BTreeFixedLeaf<K>::put_handle(uint i, Handle handle) {
+    char *slot = handle_slot(i);
+    memcpy(slot, &handle.first, sizeof(BlockID));
+    memcpy(slot + sizeof(BlockID), &handle.second, sizeof(RecordID));
+}
+
+// Slide entries i and after over one and put key, handle in as entry i. There must be room.
+template<typename K>
+void BTreeFixedLeaf<K>::insert_at(uint i, K key, Handle handle) {
+    uint n = this->size();
+    K *keys = this->keys();
+    memmove(keys + i + 1, keys + i, (n - i) * sizeof(K));
+    memmove(handle_slot(i + 1), handle_slot(i), (n - i) * HANDLE_SZ);
+    keys[i] = key;
+    put_handle(i, handle);
+    this->header()->count++;
+}
+
+template<typename K>
+bool BTreeFixedLeaf<K>::find_eq(K key, Handle &handle) const {
+    uint n = this->size();
+    uint i = BTreeFixedNode<K>::search(this->keys(), n, key, false);
+    if (i == n || this->keys()[i] != key)
+        return false;
+    handle = handle_at(i);
+    return true;
+}
+
+// Append the handles for all our keys from min_key to max_key (inclusive, null for unbounded) in key order.
+// Returns true if the range may continue into the next leaf.
+template<typename K>
+bool BTreeFixedLeaf<K>::find_range(const K *min_key, const K *max_key, Handles *handles) const {
+    uint n = this->size();
+    const K *keys = this->keys();
+    for (uint i = min_key == nullptr ? 0 : BTreeFixedNode<K>::search(keys, n, *min_key, false); i < n; i++) {
+        if (max_key != nullptr && *max_key < keys[i])
+            return false;
+        handles->push_back(handle_at(i));
+    }
+    return true;
+}
+
+// Insert key, handle pair. A split is even, except when the key goes after all the others in the rightmost leaf:
+// then fill_factor percent of the entries stay here, since later keys will all go to the new leaf.
+template<typename K>
+typename BTreeFixedLeaf<K>::Split BTreeFixedLeaf<K>::insert(K key, Handle handle, uint fill_factor) {
+    uint n = this->size();
+    K *keys = this->keys();
+    uint at = BTreeFixedNode<K>::search(keys, n, key, false);
+    if (at < n && keys[at] == key)
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    if (n < CAPACITY) {
+        insert_at(at, key, handle);
+        this->save();
+        return Split(0, K());
+    }
+
+    // full, so split the n + 1 entries (entry j is the new one if j == at, else old entry j, or j - 1 past at)
+    uint total = n + 1;
+    uint split = total / 2;  // how many to keep (the rest move to the sister)
+    if (get_next_leaf() == 0 && at == n)
+        split = max(1U, min(total - 1, total * fill_factor / 100));
+    BTreeFixedLeaf *nleaf = new BTreeFixedLeaf(this->file, 0, this->key_profile, true);
+    nleaf->set_next_leaf(get_next_leaf());
+    set_next_leaf(nleaf->id);
+    for (uint j = split; j < total; j++) {
+        if (j == at)
+            nleaf->append(key, handle);
+        else
+            nleaf->append(keys[j < at ? j : j - 1], handle_at(j < at ? j : j - 1));
+    }
+    if (at < split) {
+        this->header()->count = (uint16_t) (split - 1);
+        insert_at(at, key, handle);
+    } else {
+        this->header()->count = (uint16_t) split;
+    }
+
+    Split ret(nleaf->id, nleaf->keys()[0]);
+    nleaf->save();
+    delete nleaf;
+    this->save();
+    return ret;
+}
+
+// Remove the entry for key, which must be for handle. Returns true if we are left less than half full.
+template<typename K>
+bool BTreeFixedLeaf<K>::del(K key, Handle handle) {
+    uint n = this->size();
+    K *keys = this->keys();
+    uint i = BTreeFixedNode<K>::search(keys, n, key, false);
+    if (i == n || keys[i] != key || handle_at(i) != handle)
+        throw DbRelationError("key to delete not found in index");
+    memmove(keys + i, keys + i + 1, (n - i - 1) * sizeof(K));
+    memmove(handle_slot(i), handle_slot(i + 1), (n - i - 1) * HANDLE_SZ);
+    this->header()->count--;
+    this->save();
+    return this->size() < CAPACITY / 2;
+}
+
+// Take all the entries from the leaf just to our right, if they fit. Returns false (and changes nothing) if not.
+template<typename K>
+bool BTreeFixedLeaf<K>::absorb(BTreeFixedLeaf *right) {
+    uint n = this->size(), m = right->size();
+    if (n + m > CAPACITY)
+        return false;
+    memcpy(this->keys() + n, right->keys(), m * sizeof(K));
+    memcpy(handle_slot(n), right->handle_slot(0), m * HANDLE_SZ);
+    this->header()->count = (uint16_t) (n + m);
+    set_next_leaf(right->get_next_leaf());
+    return true;
+}
+
+template<typename K>
+void BTreeFixedLeaf<K>::append(K key, Handle handle) {
+    uint n = this->size();
+    if (n == CAPACITY)
+        throw DbRelationError("fixed-width B-tree leaf is full");
+    this->keys()[n] = key;
+    put_handle(n, handle);
+    this->header()->count++;
+}
+
+// Get the next leaf to the right (freed by caller). Only call if next_leaf is set.
+template<typename K>
+BTreeFixedLeaf<K> *BTreeFixedLeaf<K>::next() const {
+    return new BTreeFixedLeaf(this->file, get_next_leaf(), this->key_profile, false);
+}
+
+
+/**********************
+ * BTreeFixedInterior *
+ **********************/
+
+template<typename K>
+BTreeFixedInterior<K>::BTreeFixedInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile,
+                                          bool create) : BTreeFixedNode<K>(file, block_id, key_profile, create) {
+}
+
+template<typename K>
+BTreeNode *BTreeFixedInterior<K>::find(const K *key, uint depth) const {
+    BlockID down = get_first();
+    if (key != nullptr)
+        down = child(BTreeFixedNode<K>::search(this->keys(), this->size(), *key, true));
+    if (depth == 2)
+        return new BTreeFixedLeaf<K>(this->file, down, this->key_profile, false);
+    else
+        return BTreeNodeCache::instance().get<BTreeFixedInterior>(this->file, down, this->key_profile);
+}
+
+// Insert boundary, block_id pair, after any equal boundary. If this node is at the right edge of its level
+// (rightmost) and the boundary goes at the end, a split keeps fill_factor percent of the entries here; otherwise
+// a split is even.
+template<typename K>
+typename BTreeFixedInterior<K>::Split BTreeFixedInterior<K>::insert(K boundary, BlockID block_id, bool rightmost,
+                                                                    uint fill_factor) {
+    uint n = this->size();
+    K *keys = this->keys();
+    BlockID *pointers = this->pointers();
+    uint at = BTreeFixedNode<K>::search(keys, n, boundary, true);
+    if (n < CAPACITY) {
+        memmove(keys + at + 1, keys + at, (n - at) * sizeof(K));
+        memmove(pointers + at + 1, pointers + at, (n - at) * sizeof(BlockID));
+        keys[at] = boundary;
+        pointers[at] = block_id;
+        this->header()->count++;
+        this->save();
+        return Split(0, K());
+    }
+
+    // full, so split: the pointer of the split entry becomes the sister's first, and its boundary moves up
+    uint total = n + 1;
+    uint split = total / 2;
+    if (rightmost && at == n && total >= 4)
+        split = max(1U, min(total - 2, total * fill_factor / 100));
+    K all_keys[CAPACITY + 1];
+    BlockID all_pointers[CAPACITY + 1];
+    memcpy(all_keys, keys, at * sizeof(K));
+    memcpy(all_pointers, pointers, at * sizeof(BlockID));
+    all_keys[at] = boundary;
+    all_pointers[at] = block_id;
+    memcpy(all_keys + at + 1, keys + at, (n - at) * sizeof(K));
+    memcpy(all_pointers + at + 1, pointers + at, (n - at) * sizeof(BlockID));
+
+    BTreeFixedInterior *nnode = new BTreeFixedInterior(this->file, 0, this->key_profile, true);
+    nnode->set_first(all_pointers[split]);
+    for (uint j = split + 1; j < total; j++)
+        nnode->append(all_keys[j], all_pointers[j]);
+    memcpy(keys, all_keys, split * sizeof(K));
+    memcpy(pointers, all_pointers, split * sizeof(BlockID));
+    this->header()->count = (uint16_t) split;
+
+    Split ret(nnode->id, all_keys[split]);
+    nnode->save();
+    delete nnode;
+    this->save();
+    return ret;
+}
+
+// A child leaf has underflowed, so try to merge it with a sibling under this node, as BTreeInterior::merge_leaf.
+template<typename K>
+void BTreeFixedInterior<K>::merge_leaf(BTreeFixedLeaf<K> *leaf) {
+    uint n = this->size();
+    uint i = 0;  // entry whose boundary and pointer go
+    if (leaf->get_id() == get_first()) {
+        if (n == 0)
+            return;  // only child, nothing to merge with
+        BTreeFixedLeaf<K> right(this->file, pointers()[0], this->key_profile, false);
+        if (!leaf->absorb(&right))
+            return;
+        leaf->save();
+    } else {
+        while (i < n && pointers()[i] != leaf->get_id())
+            i++;
+        if (i == n)
+            throw DbRelationError("leaf " + to_string(leaf->get_id()) + " not under interior " + to_string(this->id));
+        BTreeFixedLeaf<K> left(this->file, child(i), this->key_profile, false);
+        if (!left.absorb(leaf))
+            return;
+        left.save();
+    }
+    memmove(this->keys() + i, this->keys() + i + 1, (n - i - 1) * sizeof(K));
+    memmove(pointers() + i, pointers() + i + 1, (n - i - 1) * sizeof(BlockID));
+    this->header()->count--;
+    this->save();
+}
+
+template<typename K>
+void BTreeFixedInterior<K>::append(K boundary, BlockID block_id) {
+    uint n = this->size();
+    if (n == CAPACITY)
+        throw DbRelationError("fixed-width B-tree interior node is full");
+    this->keys()[n] = boundary;
+    pointers()[n] = block_id;
+    this->header()->count++;
+}
+
+
+/*******************
+ * BTreeFixedIndex *
+ *******************/
+
+template<typename K>
+BTreeFixedIndex<K>::BTreeFixedIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : BTreeIndex(relation, name, key_columns, unique) {
+    if (!unique)
+        throw DbRelationError("fixed-width B-tree index " + name + " must have a unique key");
+    if (key_profile.size() != 1 ||
+        (key_profile[0] != ColumnAttribute::INT && key_profile[0] != ColumnAttribute::BOOLEAN))
+        throw DbRelationError("fixed-width B-tree index " + name + " needs one INT or BOOLEAN key column");
+}
+
+// Create the index: pull all the keys out of the relation, sort them, and build the tree bottom-up. The entries
+// are small enough (sizeof(K) plus a handle) to sort in memory.
+template<typename K>
+void BTreeFixedIndex<K>::create() {
+    file.create();
+    stat = new BTreeStat(file, STAT, STAT + 1, key_profile, fill_factor);
+    stat->set_key_format(BTreeStat::FIXED_KEYS);
+    stat->save();
+    closed = false;
+    try {
+        vector<pair<K, Handle>> entries;
+        for_each_key([&entries](KeyValue &key, Handle handle) { entries.push_back(make_pair((K) key[0].n, handle)); });
+        sort(entries.begin(), entries.end());
+        build(entries);
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+template<typename K>
+void BTreeFixedIndex<K>::build(const vector<pair<K, Handle>> &entries) {
+    const uint leaf_fill = max(1U, Leaf::CAPACITY * fill_factor / 100);
+    FixedLevel leaves;
+    Leaf *leaf = new Leaf(file, 0, key_profile, true);
+    try {
+        leaves.push_back(make_pair(K(), leaf->get_id()));
+        for (u_long j = 0; j < entries.size(); j++) {
+            if (j > 0 && entries[j].first == entries[j - 1].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+            if (leaf->size() == leaf_fill) {
+                Leaf *next = new Leaf(file, 0, key_profile, true);
+                leaf->set_next_leaf(next->get_id());
+                leaf->save();
+                delete leaf;
+                leaf = next;
+                leaves.push_back(make_pair(entries[j].first, leaf->get_id()));
+            }
+            leaf->append(entries[j].first, entries[j].second);
+        }
+        leaf->save();
+    } catch (...) {
+        delete leaf;
+        throw;
+    }
+    delete leaf;
+
+    uint height = 1;
+    FixedLevel level = leaves;
+    while (level.size() > 1) {
+        level = build_fixed_level(level);
+        height++;
+    }
+    stat->set_root_id(level[0].second);
+    stat->set_height(height);
+    stat->save();
+    delete root;
+    root = nullptr;
+    read_root();
+}
+
+// Write the interior nodes over the given level, filling each to fill_factor. Returns the level they make.
+template<typename K>
+typename BTreeFixedIndex<K>::FixedLevel BTreeFixedIndex<K>::build_fixed_level(const FixedLevel &below) {
+    const uint interior_fill = max(1U, Interior::CAPACITY * fill_factor / 100);
+    FixedLevel level;
+    Interior *node = new Interior(file, 0, key_profile, true);
+    try {
+        node->set_first(below[0].second);
+        level.push_back(make_pair(below[0].first, node->get_id()));
+        for (u_long j = 1; j < below.size(); j++) {
+            if (node->size() == interior_fill) {
+                node->save();
+                delete node;
+                node = new Interior(file, 0, key_profile, true);
+                node->set_first(below[j].second);
+                level.push_back(make_pair(below[j].first, node->get_id()));
+                continue;
+            }
+            node->append(below[j].first, below[j].second);
+        }
+        node->save();
+    } catch (...) {
+        delete node;
+        throw;
+    }
+    delete node;
+    return level;
+}
+
+template<typename K>
+void BTreeFixedIndex<K>::read_root() {
+    if (stat->get_height() == 1)
+        root = new Leaf(file, stat->get_root_id(), key_profile, false);
+    else
+        root = new Interior(file, stat->get_root_id(), key_profile, false);
+}
+
+template<typename K>
+K BTreeFixedIndex<K>::fixed_key(const ValueDict *key) const {
+    auto column = key->find(key_columns[0]);
+    if (column == key->end())
+        throw DbRelationError("missing key column " + key_columns[0] + " for index " + name);
+    if (column->second.data_type != key_profile[0])
+        throw DbRelationError("key column " + key_columns[0] + " is not of the key type of index " + name);
+    return (K) column->second.n;
+}
+
+template<typename K>
+typename BTreeFixedIndex<K>::Leaf *BTreeFixedIndex<K>::find_leaf(const K *key) const {
+    BTreeNode *node = root;
+    for (uint height = stat->get_height(); height > 1; height--)
+        node = static_cast<Interior *>(node)->find(key, height);  // cached, unless it's the leaf
+    return static_cast<Leaf *>(node);
+}
+
+template<typename K>
+Handles *BTreeFixedIndex<K>::lookup(ValueDict *key_dict) const {
+    K key = fixed_key(key_dict);
+    Handles *handles = new Handles();
+    Leaf *leaf = find_leaf(&key);
+    Handle handle;
+    if (leaf->find_eq(key, handle))
+        handles->push_back(handle);
+    if (leaf != root)
+        delete leaf;
+    BTreeNodeCache::instance().trim();
+    return handles;
+}
+
+template<typename K>
+Handles *BTreeFixedIndex<K>::range(ValueDict *min_key, ValueDict *max_key) const {
+    K min, max;
+    if (min_key != nullptr)
+        min = fixed_key(min_key);
+    if (max_key != nullptr)
+        max = fixed_key(max_key);
+    Handles *handles = new Handles();
+    Leaf *leaf = find_leaf(min_key == nullptr ? nullptr : &min);
+    while (leaf->find_range(min_key == nullptr ? nullptr : &min, max_key == nullptr ? nullptr : &max, handles) &&
+           leaf->get_next_leaf() != 0) {
+        Leaf *next_leaf = leaf->next();
+        if (leaf != root)
+            delete leaf;
+        leaf = next_leaf;
+    }
+    if (leaf != root)
+        delete leaf;
+    BTreeNodeCache::instance().trim();
+    return handles;
+}
+
+template<typename K>
+void BTreeFixedIndex<K>::insert(Handle handle, const ValueDict *row) {
+    open();
+    K key = fixed_key(row);
+    Split split = insert_below(root, stat->get_height(), key, handle, true);
+    if (split.first != 0) {
+        Interior *new_root = new Interior(file, 0, key_profile, true);
+        new_root->set_first(root->get_id());
+        new_root->append(split.second, split.first);
+        new_root->save();
+        stat->set_root_id(new_root->get_id());
+        stat->set_height(stat->get_height() + 1);
+        stat->save();
+        delete root;
+        root = new_root;
+    }
+    BTreeNodeCache::instance().trim();
+}
+
+// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
+// rightmost says whether node is at the right edge of its level.
+template<typename K>
+typename BTreeFixedIndex<K>::Split BTreeFixedIndex<K>::insert_below(BTreeNode *node, uint height, K key,
+                                                                    Handle handle, bool rightmost) {
+    if (height == 1)
+        return static_cast<Leaf *>(node)->insert(key, handle, stat->get_fill_factor());
+    auto *interior = static_cast<Interior *>(node);
+    BTreeNode *n = interior->find(&key, height);
+    bool n_rightmost = rightmost && n->get_id() == interior->get_last();
+    Split split;
+    try {
+        split = insert_below(n, height - 1, key, handle, n_rightmost);
+    } catch (...) {
+        if (height == 2)
+            delete n;
+        throw;
+    }
+    if (height == 2)
+        delete n;  // interior nodes belong to the node cache
+    if (split.first != 0)
+        split = interior->insert(split.second, split.first, rightmost, stat->get_fill_factor());
+    return split;
+}
+
+template<typename K>
+void BTreeFixedIndex<K>::del(Handle handle, const ValueDict *row) {
+    open();
+    K key = fixed_key(row);
+    del_below(root, stat->get_height(), key, handle);
+
+    // if merges have left the root with just one child, that child becomes the root
+    while (stat->get_height() > 1) {
+        auto *interior = static_cast<Interior *>(root);
+        if (!interior->is_pass_through())
+            break;
+        BlockID new_root_id = interior->get_first();
+        BTreeNodeCache::instance().forget(file, new_root_id);  // the root is held here, not in the cache
+        stat->set_height(stat->get_height() - 1);
+        stat->set_root_id(new_root_id);
+        stat->save();
+        delete root;
+        root = nullptr;
+        read_root();
+    }
+    BTreeNodeCache::instance().trim();
+}
+
+// Recursive delete. Returns true if node has underflowed, so its parent can try to merge it with a sibling.
+template<typename K>
+bool BTreeFixedIndex<K>::del_below(BTreeNode *node, uint height, K key, Handle handle) {
+    if (height == 1)
+        return static_cast<Leaf *>(node)->del(key, handle);
+    auto *interior = static_cast<Interior *>(node);
+    BTreeNode *n = interior->find(&key, height);
+    try {
+        bool underflow = del_below(n, height - 1, key, handle);
+        if (underflow && height == 2)
+            interior->merge_leaf(static_cast<Leaf *>(n));
+    } catch (...) {
+        if (height == 2)
+            delete n;
+        throw;
+    }
+    if (height == 2)
+        delete n;  // interior nodes belong to the node cache
+    return false;
+}
+
+template<typename K> const uint BTreeFixedLeaf<K>::HANDLE_SZ;
+template<typename K> const uint BTreeFixedLeaf<K>::CAPACITY;
+template<typename K> const uint BTreeFixedInterior<K>::CAPACITY;
+
+template class BTreeFixedNode<int32_t>;
+template class BTreeFixedLeaf<int32_t>;
+template class BTreeFixedInterior<int32_t>;
+template class BTreeFixedIndex<int32_t>;
+template class BTreeFixedNode<uint8_t>;
+template class BTreeFixedLeaf<uint8_t>;
+template class BTreeFixedInterior<uint8_t>;
+template class BTreeFixedIndex<uint8_t>;
+
+
+// Every handle the index finds for keys from min to max, checked against the expected keys of the table's rows.
+static bool fixed_range_ok(BTreeIndex &index, HeapTable &table, int32_t min, int32_t max, u_long expected) {
+    ValueDict min_key, max_key;
+    min_key["a"] = min;
+    max_key["a"] = max;
+    Handles *handles = index.range(&min_key, &max_key);
+    bool ok = handles->size() == expected;
+    int32_t previous = min - 1;
+    for (u_long i = 0; ok && i < handles->size(); i++) {
+        ValueDict *row = table.project((*handles)[i]);
+        int32_t a = (*row)["a"].n;
+        ok = a > previous && a >= min && a <= max;
+        previous = a;
+        delete row;
+    }
+    delete handles;
+    return ok;
+}
+
+/**
+ * Testing function for the fixed-width key B-tree.
+ * @return true if the tests all succeeded
+ */
+bool test_btree_fixed() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_btree_fixed", column_names, column_attributes);
+    table.create();
+    const Value b_value(std::string("b"));
+    const int32_t rows = 50 * 1000;
+    for (int32_t i = 0; i < rows; i++) {
+        ValueDict row;
+        row["a"] = Value(i * 3);
+        row["b"] = b_value;
+        table.insert(&row);
+    }
+    ColumnNames key_columns(1, "a");
+    BTreeIndex *index = BTreeIndex::make(table, "fixedindex", key_columns, true);
+    if (dynamic_cast<BTreeFixedIndex<int32_t> *>(index) == nullptr) {
+        delete index;
+        table.drop();
+        return assertion_failure("make gave no fixed-width index for an INT key");
+    }
+    BTreeIndex *text_index = BTreeIndex::make(table, "textindex", ColumnNames(1, "b"), true);
+    bool ok = dynamic_cast<BTreeFixedIndex<int32_t> *>(text_index) == nullptr || assertion_failure("TEXT key made fixed");
+    delete text_index;
+
+    // packed slots take about half the blocks of the generic nodes
+    index->create();
+    BTreeIndex generic(table, "genericindex", key_columns, true);
+    generic.create();
+    if (ok && index->file.get_last_block_id() * 3 / 2 > generic.file.get_last_block_id())
+        ok = assertion_failure("fixed-width index not smaller", index->file.get_last_block_id(),
+                               generic.file.get_last_block_id());
+
+    // opened through make, an index that was built with variable-length key nodes is rebuilt with fixed-width ones
+    generic.close();
+    BTreeIndex *upgraded = BTreeIndex::make(table, "genericindex", key_columns, true);
+    upgraded->open();
+    ok = ok && (upgraded->stat->get_key_format() == BTreeStat::FIXED_KEYS ||
+                assertion_failure("not rebuilt with fixed-width keys", upgraded->stat->get_key_format()));
+    ValueDict upgraded_key;
+    upgraded_key["a"] = Value(rows * 3 - 3);
+    Handles *upgraded_handles = upgraded->lookup(&upgraded_key);
+    ok = ok && (upgraded_handles->size() == 1 || assertion_failure("lookup after rebuild", upgraded_handles->size()));
+    delete upgraded_handles;
+    upgraded->drop();
+    delete upgraded;
+
+    ValueDict key;
+    for (int32_t i = 0; ok && i < rows * 3; i += 7) {
+        key["a"] = i;
+        Handles *handles = index->lookup(&key);
+        if (handles->size() != (i % 3 == 0 ? 1U : 0U))
+            ok = assertion_failure("fixed lookup", i);
+        delete handles;
+    }
+    ok = ok && (fixed_range_ok(*index, table, 0, rows * 3, rows) || assertion_failure("fixed range after create"));
+
+    // a unique-key probe (as SQLExec::insert does) through another object for the same index, opened from its file
+    index->close();
+    BTreeIndex *reopened = BTreeIndex::make(table, "fixedindex", key_columns, true);
+    reopened->open();
+    key["a"] = Value(3);
+    ok = ok && (reopened->contains(&key) || assertion_failure("probe of a reopened index missed"));
+    key["a"] = Value(4);
+    ok = ok && (!reopened->contains(&key) || assertion_failure("probe of a reopened index found a missing key"));
+    key["a"] = b_value;
+    try {
+        reopened->contains(&key);
+        ok = assertion_failure("probe with a TEXT key not rejected");
+    } catch (DbRelationError &e) {
+    }
+    reopened->close();
+    delete reopened;
+    index->open();
+
+    // grow at both ends and in the middle, splitting leaves and interior nodes
+    Handles added;
+    for (int32_t i = 0; ok && i < 30000; i++) {
+        ValueDict row;
+        row["a"] = i % 3 == 0 ? rows * 3 + i : (i % 3 == 1 ? -1 - i : (i / 3) * 3 * 3 + 1);
+        row["b"] = b_value;
+        Handle handle = table.insert(&row);
+        index->insert(handle);
+        added.push_back(handle);
+    }
+    ok = ok && (fixed_range_ok(*index, table, -40000, rows * 3 + 40000, rows + 30000) ||
+                assertion_failure("fixed range after inserts"));
+    try {
+        index->insert(added.back());
+        ok = assertion_failure("fixed duplicate not rejected");
+    } catch (DbRelationError &e) {
+    }
+
+    // then take them all out again, merging leaves and collapsing the root
+    for (auto const &handle: added) {
+        index->del(handle);
+        table.del(handle);
+    }
+    ok = ok && (fixed_range_ok(*index, table, -40000, rows * 3 + 40000, rows) ||
+                assertion_failure("fixed range after deletes"));
+    Handles *all = table.select();
+    for (auto const &handle: *all)
+        index->del(handle);
+    delete all;
+    ok = ok && (fixed_range_ok(*index, table, -40000, rows * 3 + 40000, 0) ||
+                assertion_failure("fixed range after deleting everything"));
+    ok = ok && (index->stat->get_height() == 1 || assertion_failure("root not collapsed", index->stat->get_height()));
+
+    index->drop();
+    delete index;
+    table.drop();
+    return ok;
+}
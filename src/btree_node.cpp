@@ -4,6 +4,7 @@
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
 
+#include <algorithm>
 #include <cstring>
 #include "btree_node.h"
 
@@ -37,51 +38,83 @@ void BTreeNode::save() {
 
 // Get the record and turn it into a block ID.
 BlockID BTreeNode::get_block_id(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID block_id = *(BlockID *) dbt->get_data();
-    delete dbt;
-    return block_id;
+    u_int16_t size;
+    return *(BlockID *) this->block->get_bytes(record_id, size);
 }
 
 // Get the record and turn it into a Handle.
 Handle BTreeNode::get_handle(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *) dbt->get_data();
-    RecordID handle_record_id = *(RecordID *) ((char *) dbt->get_data() + sizeof(BlockID));
-    delete dbt;
+    u_int16_t size;
+    const char *bytes = this->block->get_bytes(record_id, size);
+    BlockID handle_block_id = *(BlockID *) bytes;
+    RecordID handle_record_id = *(RecordID *) (bytes + sizeof(BlockID));
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
+// Keys are kept in the block normalized, so that comparing two keys' bytes with memcmp orders them as their
+// KeyValues would be ordered, column by column:
+//   INT      4 bytes, big-endian with the sign bit flipped (so negatives come first)
+//   BOOLEAN  1 byte
+//   TEXT     the bytes, with each 0x00 escaped as 0x00 0xFF, then 0x00 0x00 to end it (so a shorter string
+//            comes before any longer one it begins)
+// No column's encoding is a prefix of a different value's, so neither is the whole key's.
+static const char TEXT_ESCAPE = (char) 0xFF;
+
+// Append the normalized bytes of one value of the given type.
+static void normalize_value(ColumnAttribute::DataType data_type, const Value &value, std::string &bytes) {
+    if (value.data_type != data_type)
+        throw DbRelationError("key value is not of the index's key type");
+    if (data_type == ColumnAttribute::DataType::INT) {
+        uint32_t n = (uint32_t) value.n ^ 0x80000000U;
+        bytes += (char) (n >> 24);
+        bytes += (char) (n >> 16);
+        bytes += (char) (n >> 8);
+        bytes += (char) n;
+    } else if (data_type == ColumnAttribute::DataType::TEXT) {
+        for (char c: value.s) {
+            bytes += c;
+            if (c == '\0')
+                bytes += TEXT_ESCAPE;
         }
-        key_value->push_back(value);
+        bytes += '\0';
+        bytes += '\0';
+    } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+        bytes += (char) (uint8_t) value.n;
+    } else {
+        throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
     }
-    delete dbt;
-    return key_value;
+}
+
+std::string BTreeNode::normalize_key(const KeyProfile &key_profile, const KeyValue *key) {
+    std::string bytes;
+    uint col_num = 0;
+    for (auto const &data_type: key_profile)
+        normalize_value(data_type, (*key)[col_num++], bytes);
+    return bytes;
+}
+
+// Compare a normalized key with the one in the block, in place. Since the encoding is prefix-free, the first
+// differing byte settles it.
+int BTreeNode::compare(const std::string &key, RecordID record_id) const {
+    u_int16_t record_size;
+    const char *bytes = this->block->get_bytes(record_id, record_size);
+    int cmp = memcmp(key.data(), bytes, min(key.size(), (size_t) record_size));
+    if (cmp != 0)
+        return cmp;
+    return key.size() < record_size ? -1 : (key.size() > record_size ? 1 : 0);
+}
+
+uint BTreeNode::lower_bound(const std::string &key, uint n, bool upper) const {
+    uint low = 0, high = n;
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        int cmp = compare(key, 2 * mid + 2);
+        if (cmp > 0 || (upper && cmp == 0))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
 }
 
 // Convert block_id into bytes.
@@ -101,69 +134,27 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
-
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
-
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
-
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
-        }
-    }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
-}
-
-
 /******************************
  * BTreeStat statistics block *
  ******************************/
 
-BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile) : BTreeNode(file,
-                                                                                                                   stat_id,
-                                                                                                                   key_profile,
-                                                                                                                   false),
-                                                                                                         root_id(new_root),
-                                                                                                         height(1) {
+BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile,
+                     uint fill_factor) : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1),
+                                         fill_factor(fill_factor), key_format(NORMALIZED_KEYS) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile) : BTreeNode(file, stat_id,
                                                                                                  key_profile, false),
                                                                                        root_id(get_block_id(ROOT)),
-                                                                                       height(get_block_id(HEIGHT)) {
+                                                                                       height(get_block_id(HEIGHT)),
+                                                                                       fill_factor(
+                                                                                               DEFAULT_FILL_FACTOR),
+                                                                                       key_format(LEGACY_KEYS) {
+    if (this->block->size() >= FILL_FACTOR)
+        this->fill_factor = get_block_id(FILL_FACTOR);
+    if (this->block->size() >= KEY_FORMAT)
+        this->key_format = get_block_id(KEY_FORMAT);
 }
 
 void BTreeStat::save() {
@@ -184,166 +175,213 @@ void BTreeStat::save() {
     delete[] (char *) dbt->get_data();
     delete dbt;
 
+    dbt = marshal_block_id(this->fill_factor);  // nor is this
+    if (this->block->size() < FILL_FACTOR)
+        this->block->add(dbt);
+    else
+        this->block->put(FILL_FACTOR, *dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+
+    dbt = marshal_block_id(this->key_format);
+    if (this->block->size() < KEY_FORMAT)
+        this->block->add(dbt);
+    else
+        this->block->put(KEY_FORMAT, *dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+
     BTreeNode::save();
 }
 
 
-/*****************
- * BTreeInterior *
- *****************/
-
-BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
-        file, block_id, key_profile, create), first(0), pointers(), boundaries() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i % 2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
-            }
-            i++;
-        }
-        delete record_id_list;
-    }
+// Free a Dbt made by one of the marshal methods.
+static void free_marshaled(Dbt *dbt) {
+    delete[] (char *) dbt->get_data();
+    delete dbt;
 }
 
-BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
+// A record of page as a Dbt pointing into the page.
+static Dbt record_of(const SlottedPage &page, RecordID record_id) {
+    u_int16_t size;
+    const char *bytes = page.get_bytes(record_id, size);
+    return Dbt((void *) bytes, size);
 }
 
-// Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
+// Normalized key bytes for a debugging message, with the unprintable ones in hex.
+static std::string printable(const std::string &bytes) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c: bytes) {
+        if (c >= ' ' && c < 0x7f && c != '\\') {
+            out += (char) c;
+        } else {
+            out += "\\x";
+            out += HEX[c >> 4];
+            out += HEX[c & 0xf];
         }
     }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+    return out;
 }
 
-// Save the pointers and boundaries in the correct order
-void BTreeInterior::save() {
-    Dbt *dbt;
-    this->block->clear();
-    dbt = marshal_block_id(this->first);
-    this->block->add(dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        // key
-        dbt = marshal_key(this->boundaries[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+// Number of leading bytes a and b have in common.
+static size_t common_prefix_size(const std::string &a, const std::string &b) {
+    size_t n = min(a.size(), b.size()), i = 0;
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+
+/*****************
+ * BTreeInterior *
+ *****************/
 
-        // boundary
-        dbt = marshal_block_id(this->pointers[i]);
+BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
+        file, block_id, key_profile, create), first(0) {
+    if (create) {
+        Dbt *dbt = marshal_block_id(0);
         this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        free_marshaled(dbt);
+    } else {
+        this->first = get_block_id(1);
     }
-    BTreeNode::save();
 }
 
-// Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
-    // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
-    // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
-
-    Dbt *dbt;
+// Get next block down in tree where the normalized key must be (a null key means the leftmost child).
+BTreeNode *BTreeInterior::find(const std::string *key, uint depth) const {
+    // the pointer to the left of the first boundary after key (record 1, the first pointer, if there is none)
+    BlockID down = this->first;
+    if (key != nullptr)
+        down = get_block_id(2 * lower_bound(*key, size(), true) + 1);
+    if (depth == 2)
+        return new BTreeLeaf(this->file, down, this->key_profile, false);
+    else
+        return BTreeNodeCache::instance().get<BTreeInterior>(this->file, down, this->key_profile);
+}
 
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
-    dbt = marshal_block_id(block_id);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+void BTreeInterior::set_first(BlockID first) {
+    this->first = first;
+    Dbt *dbt = marshal_block_id(first);
+    this->block->put(1, *dbt);
+    free_marshaled(dbt);
+}
 
-        // that worked, so no need to split
+// Insert boundary, block_id pair into block, after any equal boundary. If this node is at the right edge of its
+// level (rightmost) and the boundary goes at the end, a split keeps fill_factor percent of the entries here, since
+// later keys will all go to the new node; otherwise a split is even.
+Insertion BTreeInterior::insert(const std::string &boundary, BlockID block_id, bool rightmost, uint fill_factor) {
+    // cout << "inserting (" << block_id << ", " << printable(boundary) << ") into interior node " << id; // DEBUG
+    // cout << " (pointers:" << size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
+
+    uint n = size();
+    uint at = lower_bound(boundary, n, true);
+    Dbt key_dbt((void *) boundary.data(), (u_int32_t) boundary.size());
+    Dbt *pointer_dbt = marshal_block_id(block_id);
+    if (this->block->unused_bytes() >= key_dbt.get_size() + pointer_dbt->get_size() + 8) {
+        // fits (with a record header apiece), so slide the later entries over and put it in place
+        this->block->insert(2 * at + 2, &key_dbt);
+        this->block->insert(2 * at + 3, pointer_dbt);
+        free_marshaled(pointer_dbt);
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        cout << "splitting " << *this << endl; // DEBUG
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
-
-        // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+    // too big, so split
+    cout << "splitting " << *this << endl; // DEBUG
+
+    // entry j of the n + 1 is the new one if j == at, else the one in old entry j (or j - 1, past the new one)
+    u_long total = n + 1;
+    u_long split = total / 2;
+    if (rightmost && at == n && total >= 4)
+        split = max(1UL, min(total - 2, total * fill_factor / 100));
+    char old_bytes[DbBlock::BLOCK_SZ];
+    memcpy(old_bytes, this->block->get_data(), DbBlock::BLOCK_SZ);
+    Dbt old_dbt(old_bytes, DbBlock::BLOCK_SZ);
+    SlottedPage old(old_dbt, this->id);
+    auto old_key = [&](u_long j) { return j == at ? key_dbt : record_of(old, 2 * (j < at ? j : j - 1) + 2); };
+    auto old_pointer = [&](u_long j) { return j == at ? *pointer_dbt : record_of(old, 2 * (j < at ? j : j - 1) + 3); };
+
+    // create the sister; only the pointer of the split entry goes into the sister (as it's first pointer)
+    // and the corresponding boundary is moved up to be inserted into the parent node
+    BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+    Dbt split_pointer = old_pointer(split);
+    nnode->block->put(1, split_pointer);
+    nnode->first = *(BlockID *) split_pointer.get_data();
+    Dbt split_key = old_key(split);
+    Insertion ret(nnode->id, std::string((const char *) split_key.get_data(), split_key.get_size()));
+
+    // keep the entries before the split, move the ones after it to the sister
+    this->block->clear();
+    Dbt *dbt = marshal_block_id(this->first);
+    this->block->add(dbt);
+    free_marshaled(dbt);
+    for (u_long j = 0; j < total; j++) {
+        if (j == split)
+            continue;
+        BTreeInterior *to = j < split ? this : nnode;
+        Dbt key = old_key(j), pointer = old_pointer(j);
+        to->block->add(&key);
+        to->block->add(&pointer);
+    }
+    free_marshaled(pointer_dbt);
+    // cout << "after split " << *this << endl; // DEBUG
+    // cout << "new sibling " << *nnode << endl; // DEBUG
+
+    // save everything
+    nnode->save();
+    delete nnode;
+    this->save();
+    return ret;
+}
 
-        // only the pointer of the middle entry goes into the sister (as it's first pointer)
-        // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
-        nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
 
-        // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
-        }
-        this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
-        this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
-        // cout << "after split " << *this << endl; // DEBUG
-        // cout << "new sibling " << *nnode << endl; // DEBUG
-
-        // save everything
-        nnode->save();
-        this->save();
-        return ret;
+// A child leaf has underflowed (less than half full), so try to merge it with a sibling under this node.
+// The leaf is folded into its left sibling, or if it is our first child, its right sibling is folded into it.
+// Either way the emptied sibling is unlinked from the leaf chain and its pointer and boundary are removed here.
+void BTreeInterior::merge_leaf(BTreeLeaf *leaf) {
+    uint i = 0;  // entry whose boundary and pointer go
+    if (leaf->get_id() == this->first) {
+        if (size() == 0)
+            return;  // only child, nothing to merge with
+        BTreeLeaf right(this->file, get_block_id(3), this->key_profile, false);
+        if (!leaf->absorb(&right))
+            return;
+        leaf->save();
+    } else {
+        uint n = size();
+        while (i < n && get_block_id(2 * i + 3) != leaf->get_id())
+            i++;
+        if (i == n)
+            throw DbRelationError("leaf " + to_string(leaf->get_id()) + " not under interior " + to_string(this->id));
+        BTreeLeaf left(this->file, get_block_id(2 * i + 1), this->key_profile, false);
+        if (!left.absorb(leaf))
+            return;
+        left.save();
     }
+    this->block->erase(2 * i + 3);
+    this->block->erase(2 * i + 2);
+    save();
 }
 
+void BTreeInterior::append(const std::string &boundary, BlockID block_id) {
+    Dbt boundary_dbt((void *) boundary.data(), (u_int32_t) boundary.size());
+    this->block->add(&boundary_dbt);
+    Dbt *dbt = marshal_block_id(block_id);
+    this->block->add(dbt);
+    free_marshaled(dbt);
+}
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
     out << "(interior block " << node.id << "): " << node.first;
-    if (node.boundaries.size() != node.pointers.size()) {
-        out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
+    if (node.block->last_id() % 2 == 0) {
+        out << " MISMATCH records: " << node.block->last_id();
     } else {
-        for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+        for (uint i = 0; i < node.size(); i++) {
+            Dbt boundary = record_of(*node.block, 2 * i + 2);
+            out << '|' << printable(std::string((const char *) boundary.get_data(), boundary.get_size())) << '|'
+                << node.get_block_id(2 * i + 3);
+        }
     }
     return out;
 }
@@ -358,123 +396,259 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                                key_profile,
                                                                                                                create),
                                                                                                      next_leaf(0),
-                                                                                                     key_map() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-                delete key_value;
-            }
-            i++;
-        }
-        delete record_id_list;
+                                                                                                     prefix() {
+    if (create) {
+        put_trailer();
+    } else {
+        u_int16_t size;
+        const char *bytes = this->block->get_bytes(this->block->last_id(), size);
+        this->next_leaf = *(BlockID *) bytes;
+        this->prefix.assign(bytes + sizeof(BlockID), size - sizeof(BlockID));
     }
 }
 
-BTreeLeaf::~BTreeLeaf() {
+// Write the last record: the next leaf, then the prefix.
+void BTreeLeaf::put_trailer() {
+    std::string trailer((const char *) &this->next_leaf, sizeof(BlockID));
+    trailer += this->prefix;
+    Dbt dbt((void *) trailer.data(), (u_int32_t) trailer.size());
+    if (this->block->last_id() == 0 || this->block->last_id() % 2 == 0)
+        this->block->add(&dbt);
+    else
+        this->block->put(this->block->last_id(), dbt);
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+// Index of the first entry whose key is not before the normalized key (or is after it, if upper). A key that
+// doesn't begin with the prefix is before or after all of them.
+uint BTreeLeaf::bound(const std::string &key, bool upper) const {
+    int cmp = key.compare(0, this->prefix.size(), this->prefix);
+    if (cmp != 0)
+        return cmp < 0 ? 0 : size();
+    return lower_bound(key.substr(this->prefix.size()), size(), upper);
 }
 
-// Save the key_map and next_leaf data in the correct order
-void BTreeLeaf::save() {
-    Dbt *dbt;
-    this->block->clear();
-    for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+// Full normalized key of entry i.
+std::string BTreeLeaf::key_at(uint i) const {
+    u_int16_t size;
+    const char *bytes = this->block->get_bytes(2 * i + 2, size);
+    return this->prefix + std::string(bytes, size);
+}
 
-        // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+// Find the handle for a given normalized key
+Handle BTreeLeaf::find_eq(const std::string &key) const {
+    uint i = bound(key);
+    if (i == size() || key_at(i) != key)
+        throw DbRelationError("key not found in index");
+    return get_handle(2 * i + 1);
+}
+
+// Append the handles for all our keys from min_key to max_key (inclusive, null for unbounded) in key order.
+// Returns true if the range may continue into the next leaf.
+bool BTreeLeaf::find_range(const std::string *min_key, const std::string *max_key, Handles *handles) const {
+    uint n = size();
+    uint end = max_key == nullptr ? n : bound(*max_key, true);
+    for (uint i = min_key == nullptr ? 0 : bound(*min_key); i < end; i++)
+        handles->push_back(get_handle(2 * i + 1));
+    return end == n;
+}
+
+// Get the next leaf to the right (freed by caller). Only call if next_leaf is set.
+BTreeLeaf *BTreeLeaf::next() const {
+    return new BTreeLeaf(this->file, this->next_leaf, this->key_profile, false);
+}
+
+void BTreeLeaf::set_next_leaf(BlockID next_leaf) {
+    this->next_leaf = next_leaf;
+    put_trailer();
+}
+
+void BTreeLeaf::insert_entry(uint i, const Dbt &handle, const Dbt &key) {
+    this->block->insert(2 * i + 1, &handle);
+    this->block->insert(2 * i + 2, &key);
+}
+
+// Every entry, with its full key, in order.
+void BTreeLeaf::get_entries(LeafEntries &entries) const {
+    for (uint i = 0; i < size(); i++)
+        entries.push_back(LeafEntry(get_handle(2 * i + 1), key_at(i)));
+}
+
+u_long BTreeLeaf::bytes_needed(const LeafEntries &entries, u_long from, u_long to) {
+    const u_long RECORD_HEADER = 4;
+    size_t prefix_size = to - from > 1 ? common_prefix_size(entries[from].second, entries[to - 1].second) : 0;
+    u_long bytes = RECORD_HEADER + RECORD_HEADER + sizeof(BlockID) + prefix_size;  // page header and trailer
+    for (u_long j = from; j < to; j++)
+        bytes += RECORD_HEADER + sizeof(BlockID) + sizeof(RecordID) + RECORD_HEADER + entries[j].second.size() -
+                 prefix_size;
+    return bytes;
+}
+
+// Replace our entries with entries[from..to), taking the longest prefix they all share out of their keys. Since
+// they're in order, that is the prefix the first and last share.
+void BTreeLeaf::put_entries(const LeafEntries &entries, u_long from, u_long to) {
+    size_t prefix_size = to - from > 1 ? common_prefix_size(entries[from].second, entries[to - 1].second) : 0;
+    this->prefix = to > from ? entries[from].second.substr(0, prefix_size) : std::string();
+    this->block->clear();
+    for (u_long j = from; j < to; j++) {
+        Dbt *handle_dbt = marshal_handle(entries[j].first);
+        this->block->add(handle_dbt);
+        free_marshaled(handle_dbt);
+        const std::string &key = entries[j].second;
+        Dbt suffix((void *) (key.data() + prefix_size), (u_int32_t) (key.size() - prefix_size));
+        this->block->add(&suffix);
     }
-    // next leaf pointer is final record
-    dbt = marshal_block_id(this->next_leaf);
-    this->block->add(dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    put_trailer();
+}
 
-    BTreeNode::save();
+// Remove the entry for the normalized key, which must be for handle. Returns true if we are left less than half full.
+bool BTreeLeaf::del(const std::string &key, Handle handle) {
+    uint i = bound(key);
+    if (i == size() || key_at(i) != key || get_handle(2 * i + 1) != handle)
+        throw DbRelationError("key to delete not found in index");
+    this->block->erase(2 * i + 2);
+    this->block->erase(2 * i + 1);
+    save();
+    return this->block->unused_bytes() > DbBlock::BLOCK_SZ / 2;
+}
+
+// Take all the entries from the leaf just to our right, if they fit. Returns false (and changes nothing) if not.
+// The two leaves' prefixes may differ, so the entries are put back under the prefix they all share.
+bool BTreeLeaf::absorb(BTreeLeaf *right) {
+    LeafEntries entries;
+    get_entries(entries);
+    right->get_entries(entries);
+    if (bytes_needed(entries, 0, entries.size()) > DbBlock::BLOCK_SZ - 1)
+        return false;
+    this->next_leaf = right->next_leaf;
+    put_entries(entries, 0, entries.size());
+    return true;
 }
 
-// Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
-    // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
+// Insert key, handle pair into block. A split is even, except when the key goes after all the others in the
+// rightmost leaf: then fill_factor percent of the entries stay here, since later keys will all go to the new leaf.
+// The boundary handed up is cut short: just enough of the new leaf's first key to sort after our last one.
+Insertion BTreeLeaf::insert(const std::string &normalized, Handle handle, uint fill_factor) {
+    // cout << "inserting " << printable(normalized) << " into leaf " << id << endl; // DEBUG
     // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
+    uint n = size();
+    if (normalized.size() > MAX_KEY_SZ)
+        throw DbRelationError("index key too big to marshal");
+    uint at = bound(normalized);
+    if (at < n && key_at(at) == normalized)
         throw DbRelationError("Duplicate keys are not allowed in unique index");
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+    Dbt *handle_dbt = marshal_handle(handle);
+    if (normalized.compare(0, this->prefix.size(), this->prefix) == 0 &&
+        this->block->unused_bytes() >= normalized.size() - this->prefix.size() + handle_dbt->get_size() + 8) {
+        // has our prefix and fits (with a record header apiece), so slide the later entries over and put it in place
+        Dbt suffix((void *) (normalized.data() + this->prefix.size()),
+                   (u_int32_t) (normalized.size() - this->prefix.size()));
+        insert_entry(at, *handle_dbt, suffix);
+        free_marshaled(handle_dbt);
         save();
         return BTreeNode::insertion_none();
+    }
+    free_marshaled(handle_dbt);
+
+    // otherwise lay all the entries out again: under a shorter prefix if they still fit, else split between two
+    LeafEntries entries;
+    get_entries(entries);
+    entries.insert(entries.begin() + at, LeafEntry(handle, normalized));
+    u_long total = entries.size();
+    if (bytes_needed(entries, 0, total) <= DbBlock::BLOCK_SZ - 1) {
+        put_entries(entries, 0, total);
+        save();
+        return BTreeNode::insertion_none();
+    }
+    u_long split = total / 2;  // how many to keep (the rest move to the sister)
+    if (this->next_leaf == 0 && at == n)
+        split = max(1UL, min(total - 1, total * fill_factor / 100));
+    std::string boundary = separator(entries[split - 1].second, entries[split].second);
+
+    // create the sister and put her to the right
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+    nleaf->next_leaf = this->next_leaf;
+    nleaf->put_entries(entries, split, total);
+    this->next_leaf = nleaf->id;
+    put_entries(entries, 0, split);
+    cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
+    cout << " starting at value " << printable(boundary) << endl; // DEBUG
+
+    nleaf->save();
+    auto nleaf_id = nleaf->id;
+    delete nleaf;
+    this->save();
+
+    return Insertion(nleaf_id, boundary);
+}
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
-
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
-
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const &item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
-        }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
+std::string BTreeLeaf::separator(const std::string &left, const std::string &right) {
+    return right.substr(0, common_prefix_size(left, right) + 1);
+}
+
+
+/******************
+ * BTreeNodeCache *
+ ******************/
+
+BTreeNodeCache &BTreeNodeCache::instance() {
+    static BTreeNodeCache cache;
+    return cache;
+}
 
-        nleaf->save();
-        auto nleaf_id = nleaf->id;
-        delete nleaf;
-        this->save();
+BTreeNodeCache::BTreeNodeCache(uint capacity) : capacity(capacity), recency(), cached(), hits(0), misses(0) {
+}
 
-        return Insertion(nleaf_id, boundary);
+BTreeNodeCache::~BTreeNodeCache() {
+    for (auto const &entry: this->recency)
+        delete entry.second;
+}
+
+BTreeNode *BTreeNodeCache::find(HeapFile &file, BlockID block_id) {
+    auto found = this->cached.find(NodeKey(&file, block_id));
+    if (found == this->cached.end()) {
+        this->misses++;
+        return nullptr;
     }
+    this->hits++;
+    this->recency.splice(this->recency.begin(), this->recency, found->second);
+    return found->second->second;
 }
 
+void BTreeNodeCache::add(HeapFile &file, BTreeNode *node) {
+    NodeKey key(&file, node->get_id());
+    this->recency.push_front(make_pair(key, node));
+    this->cached[key] = this->recency.begin();
+}
 
+void BTreeNodeCache::forget(HeapFile &file, BlockID block_id) {
+    auto found = this->cached.find(NodeKey(&file, block_id));
+    if (found == this->cached.end())
+        return;
+    delete found->second->second;
+    this->recency.erase(found->second);
+    this->cached.erase(found);
+}
+
+void BTreeNodeCache::forget(HeapFile &file) {
+    auto entry = this->cached.lower_bound(NodeKey(&file, 0));
+    while (entry != this->cached.end() && entry->first.first == &file) {
+        delete entry->second->second;
+        this->recency.erase(entry->second);
+        entry = this->cached.erase(entry);
+    }
+}
+
+void BTreeNodeCache::trim() {
+    while (this->cached.size() > this->capacity) {
+        auto &oldest = this->recency.back();
+        this->cached.erase(oldest.first);
+        delete oldest.second;
+        this->recency.pop_back();
+    }
+}
+
+void BTreeNodeCache::set_capacity(uint capacity) {
+    this->capacity = capacity;
+    trim();
+}
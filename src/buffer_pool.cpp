@@ -0,0 +1,269 @@
+/**
+ * @file buffer_pool.cpp
+ * @author K Lundeen
+ * @see Seattle University, CPSC5300
+ */
+#include "buffer_pool.h"
+#include "heap_file.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The buffer pool shared by all the heap files.
+ * @return the pool
+ */
+BufferPool &BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+/**
+ * Constructor
+ * @param frame_count  number of blocks the pool can hold at once
+ */
+BufferPool::BufferPool(uint frame_count) : frame_count(frame_count), frames(nullptr), resident(), clock_hand(0),
+                                           hits(0), misses(0), evictions(0), writes(0), latch() {
+    this->frames = new BufferFrame[frame_count];
+}
+
+/**
+ * Destructor. Dirty frames are not written here -- files flush their own
+ * frames when they are closed.
+ */
+BufferPool::~BufferPool() {
+    delete[] this->frames;
+}
+
+/**
+ * Pin the given block into a frame, reading it from the file if it isn't
+ * already resident.
+ * @param file      file the block belongs to
+ * @param block_id  which block
+ * @return          the pinned frame (caller must unpin it)
+ * @throws DbRelationError if every frame is pinned
+ */
+BufferFrame *BufferPool::pin(HeapFile *file, BlockID block_id) {
+    lock_guard<mutex> guard(this->latch);
+    auto found = this->resident.find(FrameKey(file, block_id));
+    if (found != this->resident.end()) {
+        this->hits++;
+        found->second->pin();
+        return found->second;
+    }
+    this->misses++;
+    BufferFrame *frame = victim();
+    file->read_block(block_id, frame->data);
+    frame->file = file;
+    frame->block_id = block_id;
+    frame->dirty = false;
+    this->resident[FrameKey(file, block_id)] = frame;
+    frame->pin();
+    return frame;
+}
+
+/**
+ * Pin a zeroed frame for a block just added to the file. The block is not
+ * read in and the caller is responsible for writing it out.
+ * @param file      file the block belongs to
+ * @param block_id  the new block's id
+ * @return          the pinned frame (caller must unpin it)
+ * @throws DbRelationError if every frame is pinned
+ */
+BufferFrame *BufferPool::pin_new(HeapFile *file, BlockID block_id) {
+    lock_guard<mutex> guard(this->latch);
+    auto found = this->resident.find(FrameKey(file, block_id));
+    BufferFrame *frame = found != this->resident.end() ? found->second : victim();
+    memset(frame->data, 0, DbBlock::BLOCK_SZ);
+    frame->file = file;
+    frame->block_id = block_id;
+    frame->dirty = false;
+    this->resident[FrameKey(file, block_id)] = frame;
+    frame->pin();
+    return frame;
+}
+
+/**
+ * Record a change to a block. If the block is resident, its frame is marked
+ * dirty and written back later; otherwise the data is written straight to the
+ * file.
+ * @param file      file the block belongs to
+ * @param block_id  which block
+ * @param data      the block's new contents (usually the frame's own bytes)
+ */
+void BufferPool::put(HeapFile *file, BlockID block_id, const void *data) {
+    lock_guard<mutex> guard(this->latch);
+    auto found = this->resident.find(FrameKey(file, block_id));
+    if (found == this->resident.end()) {
+        file->write_block(block_id, data);
+        this->writes++;
+        return;
+    }
+    BufferFrame *frame = found->second;
+    if (frame->data != data)
+        memcpy(frame->data, data, DbBlock::BLOCK_SZ);
+    frame->dirty = true;
+}
+
+/**
+ * Write back all the dirty frames (for one file or for all of them).
+ * @param file  file whose frames to write, or nullptr for every file
+ */
+void BufferPool::flush(HeapFile *file) {
+    lock_guard<mutex> guard(this->latch);
+    for (auto const &entry: this->resident)
+        if (file == nullptr || entry.first.first == file)
+            write_back(entry.second);
+}
+
+/**
+ * Forget all the frames for a file without writing them. A frame that is
+ * still pinned is detached from the file and freed when its last pin goes.
+ * @param file  the file being closed, dropped, or destroyed
+ */
+void BufferPool::discard(HeapFile *file) {
+    lock_guard<mutex> guard(this->latch);
+    auto entry = this->resident.lower_bound(FrameKey(file, 0));
+    while (entry != this->resident.end() && entry->first.first == file) {
+        BufferFrame *frame = entry->second;
+        frame->file = nullptr;
+        frame->dirty = false;
+        frame->referenced = false;
+        entry = this->resident.erase(entry);
+    }
+}
+
+/**
+ * Number of frames currently pinned.
+ * @return pinned frame count
+ */
+uint BufferPool::get_pinned_count() const {
+    uint n = 0;
+    for (uint i = 0; i < this->frame_count; i++)
+        if (this->frames[i].pin_count > 0)
+            n++;
+    return n;
+}
+
+/**
+ * Pick a frame to reuse with CLOCK replacement: sweep past pinned frames and
+ * give recently referenced ones a second chance. A dirty victim is written
+ * back before it is handed out.
+ * @return an unpinned frame no longer holding any block
+ * @throws DbRelationError if every frame is pinned
+ */
+BufferFrame *BufferPool::victim() {
+    for (uint sweep = 0; sweep < 2 * this->frame_count; sweep++) {
+        BufferFrame *frame = &this->frames[this->clock_hand];
+        this->clock_hand = (this->clock_hand + 1) % this->frame_count;
+        if (frame->pin_count > 0)
+            continue;
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        if (frame->file != nullptr) {
+            write_back(frame);
+            this->resident.erase(FrameKey(frame->file, frame->block_id));
+            frame->file = nullptr;
+            this->evictions++;
+        }
+        return frame;
+    }
+    throw DbRelationError("buffer pool has no unpinned frames");
+}
+
+/**
+ * Write a frame's block to its file if it has changed since it was read.
+ * @param frame  the frame to write
+ */
+void BufferPool::write_back(BufferFrame *frame) {
+    if (!frame->dirty || frame->file == nullptr)
+        return;
+    frame->file->write_block(frame->block_id, frame->data);
+    frame->dirty = false;
+    this->writes++;
+}
+
+std::ostream &operator<<(std::ostream &out, const BufferPool &pool) {
+    out << "buffer pool: " << pool.get_frame_count() << " frames, " << pool.get_pinned_count() << " pinned, "
+        << pool.get_hits() << " hits, " << pool.get_misses() << " misses, " << pool.get_evictions() << " evictions, "
+        << pool.get_writes() << " writes";
+    return out;
+}
+
+/**
+ * Testing function for the buffer pool.
+ * @return true if the tests all succeeded
+ */
+bool test_buffer_pool() {
+    BufferPool &pool = BufferPool::instance();
+    uint pinned = pool.get_pinned_count();
+    BlockID block_count = pool.get_frame_count() + 50;
+
+    // write more blocks than the pool has frames, so some have to be evicted and written back
+    HeapFile file("_test_buffer_pool");
+    file.create();
+    unsigned long evictions = pool.get_evictions();
+    for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+        SlottedPage *page = block_id == 1 ? file.get(block_id) : file.get_new();
+        Dbt data(&block_id, sizeof(block_id));
+        page->add(&data);
+        file.put(page);
+        delete page;
+    }
+    if (pool.get_evictions() == evictions)
+        return assertion_failure("no evictions");
+    if (pool.get_pinned_count() != pinned)
+        return assertion_failure("pages left pinned", pool.get_pinned_count(), pinned);
+
+    // everything, evicted or not, reads back
+    for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+        SlottedPage *page = file.get(block_id);
+        Dbt *data = page->get(1);
+        bool ok = data != nullptr && *(BlockID *) data->get_data() == block_id;
+        delete data;
+        delete page;
+        if (!ok)
+            return assertion_failure("block read back wrong", block_id);
+    }
+
+    // a resident block is a hit
+    unsigned long hits = pool.get_hits();
+    delete file.get(block_count);
+    delete file.get(block_count);
+    if (pool.get_hits() == hits)
+        return assertion_failure("no hits");
+
+    // pinning more blocks than there are frames fails cleanly
+    vector<SlottedPage *> held;
+    bool exhausted = false;
+    try {
+        for (BlockID block_id = 1; block_id <= block_count; block_id++)
+            held.push_back(file.get(block_id));
+    } catch (DbRelationError &e) {
+        exhausted = true;
+    }
+    for (auto page: held)
+        delete page;
+    if (!exhausted)
+        return assertion_failure("pinned more blocks than there are frames");
+    if (pool.get_pinned_count() != pinned)
+        return assertion_failure("pages left pinned after exhaustion", pool.get_pinned_count(), pinned);
+
+    // a frame can't be unpinned more times than it was pinned
+    BufferFrame *frame = pool.pin(&file, 1);
+    frame->unpin();
+    bool unbalanced = false;
+    try {
+        frame->unpin();
+    } catch (DbRelationError &e) {
+        unbalanced = true;
+    }
+    if (!unbalanced)
+        return assertion_failure("unpinned a frame that wasn't pinned");
+
+    file.drop();
+    return true;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file column_batch.cpp - implementation of ColumnVector and ColumnBatch
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include "column_batch.h"
+
+using namespace std;
+
+ColumnVector::ColumnVector(ColumnAttribute::DataType data_type, uint capacity) : data_type(data_type), ints(),
+                                                                                 offsets(), lengths(), arena() {
+    if (data_type == ColumnAttribute::TEXT) {
+        offsets.resize(capacity);
+        lengths.resize(capacity);
+        arena.reserve(capacity * 16);
+    } else {
+        ints.resize(capacity);
+    }
+}
+
+Value ColumnVector::get_value(uint row) const {
+    if (data_type == ColumnAttribute::TEXT)
+        return Value(string(text(row), lengths[row]));
+    Value value(ints[row]);
+    value.data_type = data_type;
+    return value;
+}
+
+ColumnBatch::ColumnBatch(const ColumnAttributes &column_attributes) : columns(), size(0), selected(0) {
+    for (auto const &column_attribute: column_attributes) {
+        ColumnAttribute ca = column_attribute;
+        columns.push_back(new ColumnVector(ca.get_data_type(), CAPACITY));
+    }
+}
+
+ColumnBatch::~ColumnBatch() {
+    for (auto column: columns)
+        delete column;
+}
+
+void ColumnBatch::clear() {
+    for (auto column: columns)
+        column->clear();
+    size = 0;
+    selected = 0;
+}
+
+void ColumnBatch::select_all() {
+    for (uint i = 0; i < size; i++)
+        selection[i] = (uint16_t) i;
+    selected = size;
+}
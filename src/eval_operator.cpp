@@ -0,0 +1,244 @@
+/**
+ * @file eval_operator.cpp - implementation of the pull-based plan operators
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include "eval_operator.h"
+
+TableScanOperator::TableScanOperator(DbRelation &table, const ValueDict *where, const ValueRanges *ranges)
+        : HandleOperator(table), where(), ranges(), scan(nullptr) {
+    if (where != nullptr)
+        this->where = *where;
+    if (ranges != nullptr)
+        this->ranges = *ranges;
+}
+
+TableScanOperator::~TableScanOperator() {
+    close();
+}
+
+void TableScanOperator::open() {
+    close();
+    this->scan = this->table.scan(this->where.empty() ? nullptr : &this->where,
+                                  this->ranges.empty() ? nullptr : &this->ranges);
+}
+
+bool TableScanOperator::next(Handle &handle) {
+    return this->scan->next(handle);
+}
+
+void TableScanOperator::close() {
+    delete this->scan;
+    this->scan = nullptr;
+}
+
+IndexLookupOperator::IndexLookupOperator(DbIndex &index, DbRelation &table, const ValueDict *key)
+        : HandleOperator(table), index(index), key(*key), handles(nullptr), i(0) {
+}
+
+IndexLookupOperator::~IndexLookupOperator() {
+    close();
+}
+
+void IndexLookupOperator::open() {
+    close();
+    this->handles = this->index.lookup(&this->key);
+    this->i = 0;
+}
+
+bool IndexLookupOperator::next(Handle &handle) {
+    if (this->i >= this->handles->size())
+        return false;
+    handle = (*this->handles)[this->i++];
+    return true;
+}
+
+void IndexLookupOperator::close() {
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+IndexRangeOperator::IndexRangeOperator(DbIndex &index, DbRelation &table, const ValueDict *min_key,
+                                       const ValueDict *max_key)
+        : HandleOperator(table), index(index), min_key(nullptr), max_key(nullptr), handles(nullptr), i(0) {
+    if (min_key != nullptr)
+        this->min_key = new ValueDict(*min_key);
+    if (max_key != nullptr)
+        this->max_key = new ValueDict(*max_key);
+}
+
+IndexRangeOperator::~IndexRangeOperator() {
+    close();
+    delete this->min_key;
+    delete this->max_key;
+}
+
+void IndexRangeOperator::open() {
+    close();
+    this->handles = this->index.range(this->min_key, this->max_key);
+    this->i = 0;
+}
+
+bool IndexRangeOperator::next(Handle &handle) {
+    if (this->i >= this->handles->size())
+        return false;
+    handle = (*this->handles)[this->i++];
+    return true;
+}
+
+void IndexRangeOperator::close() {
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+SelectOperator::SelectOperator(HandleOperator *child, const ValueDict *where, const ValueRanges *ranges)
+        : HandleOperator(child->get_table()), child(child), where(), ranges(), selected(nullptr), i(0) {
+    if (where != nullptr)
+        this->where = *where;
+    if (ranges != nullptr)
+        this->ranges = *ranges;
+}
+
+SelectOperator::~SelectOperator() {
+    close();
+    delete this->child;
+}
+
+void SelectOperator::open() {
+    close();
+    this->child->open();
+}
+
+// Pull a batch of handles from the child and keep the ones that qualify; repeat until we have some or the
+// child runs out.
+bool SelectOperator::next(Handle &handle) {
+    while (this->selected == nullptr || this->i >= this->selected->size()) {
+        Handles batch;
+        Handle child_handle;
+        while (batch.size() < BATCH_SIZE && this->child->next(child_handle))
+            batch.push_back(child_handle);
+        if (batch.empty())
+            return false;
+        delete this->selected;
+        this->selected = this->table.select(&batch, this->where.empty() ? nullptr : &this->where,
+                                            this->ranges.empty() ? nullptr : &this->ranges);
+        this->i = 0;
+    }
+    handle = (*this->selected)[this->i++];
+    return true;
+}
+
+void SelectOperator::close() {
+    delete this->selected;
+    this->selected = nullptr;
+    this->child->close();
+}
+
+ProjectOperator::ProjectOperator(HandleOperator *child, const ColumnNames *column_names, QueryArena *arena)
+        : child(child), column_names(*column_names), arena(arena), rows(nullptr), i(0) {
+}
+
+ProjectOperator::~ProjectOperator() {
+    close();
+    delete this->child;
+}
+
+void ProjectOperator::open() {
+    close();
+    this->child->open();
+}
+
+// Project a batch of handles at a time, so the rows on the same block are decoded from one fetch of it.
+bool ProjectOperator::next(Row *&row) {
+    if (this->rows == nullptr || this->i >= this->rows->size()) {
+        Handles batch;
+        Handle handle;
+        while (batch.size() < HandleOperator::BATCH_SIZE && this->child->next(handle))
+            batch.push_back(handle);
+        clear();
+        if (batch.empty())
+            return false;
+        this->rows = this->child->get_table().project_rows(&batch, &this->column_names, this->arena);
+        this->i = 0;
+    }
+    row = (*this->rows)[this->i];
+    (*this->rows)[this->i++] = nullptr;  // now belongs to the caller
+    return true;
+}
+
+void ProjectOperator::close() {
+    clear();
+    this->child->close();
+}
+
+void ProjectOperator::clear() {
+    if (this->rows != nullptr) {
+        for (auto row: *this->rows)
+            delete row;
+        delete this->rows;
+        this->rows = nullptr;
+    }
+}
+
+ScanProjectOperator::ScanProjectOperator(DbRelation &table, const ColumnNames *column_names, const ValueDict *where,
+                                         const ValueRanges *ranges, QueryArena *arena)
+        : table(table), column_names(*column_names), where(), ranges(), arena(arena), rows(nullptr) {
+    if (where != nullptr)
+        this->where = *where;
+    if (ranges != nullptr)
+        this->ranges = *ranges;
+}
+
+ScanProjectOperator::~ScanProjectOperator() {
+    close();
+}
+
+void ScanProjectOperator::open() {
+    close();
+    this->rows = this->table.rows(&this->column_names, this->where.empty() ? nullptr : &this->where,
+                                  this->ranges.empty() ? nullptr : &this->ranges, this->arena);
+}
+
+bool ScanProjectOperator::next(Row *&row) {
+    return this->rows->next(row);
+}
+
+void ScanProjectOperator::close() {
+    delete this->rows;
+    this->rows = nullptr;
+}
+
+LimitOperator::LimitOperator(RowOperator *child, u_long limit, u_long offset)
+        : child(child), limit(limit), offset(offset), skipped(0), produced(0) {
+}
+
+LimitOperator::~LimitOperator() {
+    delete this->child;
+}
+
+void LimitOperator::open() {
+    this->child->open();
+    this->skipped = 0;
+    this->produced = 0;
+}
+
+// Stop pulling from the child as soon as we have given out limit rows.
+bool LimitOperator::next(Row *&row) {
+    if (this->produced >= this->limit)
+        return false;
+    while (this->skipped < this->offset) {
+        Row *skipped_row;
+        if (!this->child->next(skipped_row))
+            return false;
+        delete skipped_row;
+        this->skipped++;
+    }
+    if (!this->child->next(row))
+        return false;
+    this->produced++;
+    return true;
+}
+
+void LimitOperator::close() {
+    this->child->close();
+}
@@ -5,6 +5,9 @@
  */
 
 #include "eval_plan.h"
+#include "schema_tables.h"
+#include "batch_exec.h"
+#include "parallel_scan.h"
 
 
 class Dummy : public DbRelation {
@@ -44,23 +47,67 @@ public:
 };
 
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+                                                        select_conjunction(nullptr), select_ranges(nullptr),
+                                                        table(Dummy::one()), index(nullptr), min_key(nullptr),
+                                                        max_key(nullptr), limit(0), offset(0) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
                                                                   projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+                                                                  select_ranges(nullptr), table(Dummy::one()),
+                                                                  index(nullptr), min_key(nullptr), max_key(nullptr), limit(0), offset(0) {
 }
 
 EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+                                                                 select_conjunction(conjunction),
+                                                                 select_ranges(nullptr), table(Dummy::one()),
+                                                                 index(nullptr), min_key(nullptr), max_key(nullptr), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(ValueDict *conjunction, ValueRanges *ranges, EvalPlan *relation) : type(Select),
+                                                                                      relation(relation),
+                                                                                      projection(nullptr),
+                                                                                      select_conjunction(conjunction),
+                                                                                      select_ranges(ranges),
+                                                                                      table(Dummy::one()),
+                                                                                      index(nullptr),
+                                                                                      min_key(nullptr),
+                                                                                      max_key(nullptr), limit(0), offset(0) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+                                        select_conjunction(nullptr), select_ranges(nullptr), table(table),
+                                        index(nullptr), min_key(nullptr), max_key(nullptr), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, DbRelation &table, ValueDict *key) : type(IndexLookup), relation(nullptr),
+                                                                        projection(nullptr), select_conjunction(key),
+                                                                        select_ranges(nullptr), table(table),
+                                                                        index(&index), min_key(nullptr),
+                                                                        max_key(nullptr), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, DbRelation &table, ValueDict *min_key, ValueDict *max_key) : type(IndexRange),
+                                                                                              relation(nullptr),
+                                                                                              projection(nullptr),
+                                                                                              select_conjunction(
+                                                                                                      nullptr),
+                                                                                              select_ranges(nullptr),
+                                                                                              table(table),
+                                                                                              index(&index),
+                                                                                              min_key(min_key),
+                                                                                              max_key(max_key), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(u_long limit, u_long offset, EvalPlan *relation) : type(Limit), relation(relation),
+                                                                     projection(nullptr), select_conjunction(nullptr),
+                                                                     select_ranges(nullptr), table(relation->table),
+                                                                     index(nullptr), min_key(nullptr), max_key(nullptr),
+                                                                     limit(limit), offset(offset) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index),
+                                            limit(other->limit), offset(other->offset) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -73,53 +120,245 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->select_ranges != nullptr)
+        select_ranges = new ValueRanges(*other->select_ranges);
+    else
+        select_ranges = nullptr;
+    if (other->min_key != nullptr)
+        min_key = new ValueDict(*other->min_key);
+    else
+        min_key = nullptr;
+    if (other->max_key != nullptr)
+        max_key = new ValueDict(*other->max_key);
+    else
+        max_key = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
     delete select_conjunction;
+    delete select_ranges;
+    delete min_key;
+    delete max_key;
+}
+
+
+EvalPlan *EvalPlan::optimize(Indices *indices) {
+    EvalPlan *ret = new EvalPlan(this);
+    if (indices != nullptr)
+        ret->use_indices(indices);
+    return ret;
 }
 
+// Replace a TableScan under a Select with an index access when one of the table's indices can
+// do some of the selection. The Select stays on top to apply whatever predicates are left.
+void EvalPlan::use_indices(Indices *indices) {
+    if (this->relation == nullptr)
+        return;
+    this->relation->use_indices(indices);
+    if (this->type != Select || this->relation->type != TableScan)
+        return;
+    if (!use_index_lookup(indices))
+        use_index_range(indices);
+}
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+// Does the table give this column the same type as the literal it is compared with? An index can
+// only find rows for a literal of its key's type (a heap scan just never matches the others).
+static bool same_type(DbRelation &table, const Identifier &column_name, const Value &value) {
+    ColumnAttributes *attributes = table.get_column_attributes(ColumnNames(1, column_name));
+    bool same = (*attributes)[0].get_data_type() == value.data_type;
+    delete attributes;
+    return same;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+// Use an IndexLookup if the equality predicates cover all the key columns of an index
+// (preferring a unique one, then a hash one). Those predicates are then dropped from this Select.
+bool EvalPlan::use_index_lookup(Indices *indices) {
+    if (this->select_conjunction == nullptr || this->select_conjunction->empty())
+        return false;
+
+    DbRelation &scan_table = this->relation->table;
+    Identifier table_name = scan_table.get_table_name();
+    Identifier best_index;
+    ColumnNames best_columns;
+    bool best_is_unique = false, best_is_hash = false;
+    for (auto const &index_name : indices->get_index_names(table_name)) {
+        ColumnNames key_columns;
+        bool is_hash = false, is_unique = false;
+        indices->get_columns(table_name, index_name, key_columns, is_hash, is_unique);
+        bool covered = true;
+        for (auto const &column_name : key_columns) {
+            auto equal = this->select_conjunction->find(column_name);
+            if (equal == this->select_conjunction->end() || !same_type(scan_table, column_name, equal->second))
+                covered = false;
+        }
+        bool better = best_index.empty() || (is_unique && !best_is_unique) ||
+                      (is_unique == best_is_unique && is_hash && !best_is_hash);
+        if (covered && better) {
+            best_index = index_name;
+            best_columns = key_columns;
+            best_is_unique = is_unique;
+            best_is_hash = is_hash;
+        }
+    }
+    if (best_index.empty())
+        return false;
+
+    ValueDict *key = new ValueDict();
+    for (auto const &column_name : best_columns) {
+        (*key)[column_name] = this->select_conjunction->at(column_name);
+        this->select_conjunction->erase(column_name);
+    }
+    DbIndex &lookup_index = indices->get_index(table_name, best_index);
+    lookup_index.open();
+    delete this->relation;
+    this->relation = new EvalPlan(lookup_index, scan_table, key);
+    return true;
+}
+
+// Use an IndexRange if a single-column BTree index covers one of the range predicates. The range
+// predicate is kept in this Select, since the index range is inclusive at both ends.
+bool EvalPlan::use_index_range(Indices *indices) {
+    if (this->select_ranges == nullptr || this->select_ranges->empty())
+        return false;
+
+    DbRelation &scan_table = this->relation->table;
+    Identifier table_name = scan_table.get_table_name();
+    for (auto const &index_name : indices->get_index_names(table_name)) {
+        ColumnNames key_columns;
+        bool is_hash = false, is_unique = false;
+        indices->get_columns(table_name, index_name, key_columns, is_hash, is_unique);
+        if (is_hash || key_columns.size() != 1)
+            continue;
+        auto range = this->select_ranges->find(key_columns[0]);
+        if (range == this->select_ranges->end())
+            continue;
+        if ((range->second.has_min && !same_type(scan_table, range->first, range->second.min)) ||
+            (range->second.has_max && !same_type(scan_table, range->first, range->second.max)))
+            continue;
+
+        ValueDict *range_min = nullptr, *range_max = nullptr;
+        if (range->second.has_min) {
+            range_min = new ValueDict();
+            (*range_min)[range->first] = range->second.min;
+        }
+        if (range->second.has_max) {
+            range_max = new ValueDict();
+            (*range_max)[range->first] = range->second.max;
+        }
+        DbIndex &range_index = indices->get_index(table_name, index_name);
+        range_index.open();
+        delete this->relation;
+        this->relation = new EvalPlan(range_index, scan_table, range_min, range_max);
+        return true;
+    }
+    return false;
+}
+
+Rows *EvalPlan::evaluate() {
+    RowOperator *rows = compile();
+    Rows *ret = new Rows();
+    Row *row;
+    rows->open();
+    while (rows->next(row))
+        ret->push_back(row);
+    rows->close();
+    delete rows;
+    return ret;
+}
+
+RowOperator *EvalPlan::compile(QueryArena *arena) const {
+    if (this->type == Limit)
+        return new LimitOperator(this->relation->compile(arena), this->limit, this->offset);
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
-    return ret;
+    // a plain scan (possibly filtered) of a table decodes its rows straight from the blocks
+    const EvalPlan *scan = this->relation->type == Select ? this->relation->relation : this->relation;
+    if (scan->type == TableScan) {
+        const ValueDict *where = nullptr;
+        const ValueRanges *ranges = nullptr;
+        if (this->relation->type == Select) {
+            where = this->relation->select_conjunction;
+            ranges = this->relation->select_ranges;
+        }
+        const ColumnNames *column_names = this->type == ProjectAll ? &scan->table.get_column_names() : this->projection;
+        return new ScanProjectOperator(scan->table, column_names, where, ranges, arena);
+    }
+
+    HandleOperator *handles = this->relation->compile_handles();
+    const ColumnNames *column_names =
+            this->type == ProjectAll ? &handles->get_table().get_column_names() : this->projection;
+    return new ProjectOperator(handles, column_names, arena);
+}
+
+RowOperator *EvalPlan::vectorize(uint workers, QueryArena *arena) const {
+    if (this->type == Limit) {
+        RowOperator *rows = this->relation->vectorize(workers, arena);
+        return rows == nullptr ? nullptr : new LimitOperator(rows, this->limit, this->offset);
+    }
+    if (this->type != ProjectAll && this->type != Project)
+        return nullptr;
+    const EvalPlan *scan = this->relation->type == Select ? this->relation->relation : this->relation;
+    if (scan->type != TableScan)
+        return nullptr;
+    const ValueDict *where = nullptr;
+    const ValueRanges *ranges = nullptr;
+    if (this->relation->type == Select) {
+        where = this->relation->select_conjunction;
+        ranges = this->relation->select_ranges;
+    }
+    const ColumnNames *column_names = this->type == ProjectAll ? &scan->table.get_column_names() : this->projection;
+    RowOperator *parallel = ParallelScan::create(scan->table, column_names, where, ranges, workers);
+    if (parallel != nullptr)
+        return parallel;
+    return BatchExecutor::create(scan->table, column_names, where, ranges, arena);
+}
+
+HandleOperator *EvalPlan::compile_handles() const {
+    if (this->type == TableScan)
+        return new TableScanOperator(this->table);
+    if (this->type == IndexLookup)
+        return new IndexLookupOperator(*this->index, this->table, this->select_conjunction);
+    if (this->type == IndexRange)
+        return new IndexRangeOperator(*this->index, this->table, this->min_key, this->max_key);
+    if (this->type == Select && this->relation->type == TableScan)
+        return new TableScanOperator(this->relation->table, this->select_conjunction, this->select_ranges);
+    if (this->type == Select && (this->select_conjunction == nullptr || this->select_conjunction->empty()) &&
+        (this->select_ranges == nullptr || this->select_ranges->empty()))
+        return this->relation->compile_handles();  // nothing left to select on (an index did it all)
+    if (this->type == Select)
+        return new SelectOperator(this->relation->compile_handles(), this->select_conjunction, this->select_ranges);
+    throw DbRelationError("Not implemented: operator other than Select, TableScan, IndexLookup, or IndexRange");
 }
 
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexLookup)
+        return EvalPipeline(&this->table, this->index->lookup(this->select_conjunction));
+    if (this->type == IndexRange)
+        return EvalPipeline(&this->table, this->index->range(this->min_key, this->max_key));
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table,
+                            this->relation->table.select(this->select_conjunction, this->select_ranges));
 
-    // recursive case
+    // recursive cases
+    if (this->type == Select && (this->select_conjunction == nullptr || this->select_conjunction->empty()) &&
+        (this->select_ranges == nullptr || this->select_ranges->empty()))
+        return this->relation->pipeline();  // nothing left to select on (an index did it all)
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction, this->select_ranges));
         delete handles;
         return ret;
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexLookup, or IndexRange");
 }
 
 
@@ -0,0 +1,511 @@
+/**
+ * @file hash_index.cpp - implementation of HashIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cstring>
+#include "hash_index.h"
+#include "heap_table.h"
+
+using namespace std;
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), closed(true), file(relation.get_table_name() + "-" + name),
+          overflow(relation.get_table_name() + "-" + name + "-overflow"), key_profile(),
+          load_factor(DEFAULT_LOAD_FACTOR), level(0), next(0), entries(0), entry_bytes(0), free_overflow(0) {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+HashIndex::~HashIndex() {
+}
+
+// Create the index: the first buckets, then an entry for every row already in the relation.
+void HashIndex::create() {
+    file.create();
+    overflow.create();
+    closed = false;
+    level = next = entries = entry_bytes = free_overflow = 0;
+    try {
+        for (uint32_t bucket = 0; bucket < INITIAL_BUCKETS; bucket++) {
+            SlottedPage *page = file.get_new();
+            put_link(page, 0);
+            file.put(page);
+            delete page;
+        }
+        save_meta();
+
+        const u_long CHUNK = 1024;
+        Handles *handles = relation.select();
+        try {
+            for (u_long i = 0; i < handles->size(); i += CHUNK) {
+                Handles chunk(handles->begin() + i, handles->begin() + min(i + CHUNK, (u_long) handles->size()));
+                ValueDicts *rows = relation.project(&chunk, &key_columns);
+                try {
+                    for (u_long j = 0; j < chunk.size(); j++)
+                        add(normalized((*rows)[j]), chunk[j]);
+                } catch (...) {
+                    for (auto row: *rows)
+                        delete row;
+                    delete rows;
+                    throw;
+                }
+                for (auto row: *rows)
+                    delete row;
+                delete rows;
+            }
+        } catch (...) {
+            delete handles;
+            throw;
+        }
+        delete handles;
+        save_meta();
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+void HashIndex::drop() {
+    file.drop();
+    overflow.drop();
+    closed = true;
+}
+
+void HashIndex::open() {
+    if (closed) {
+        file.open();
+        overflow.open();
+        read_meta();
+        closed = false;
+    }
+}
+
+void HashIndex::close() {
+    if (!closed) {
+        file.close();
+        overflow.close();
+        closed = true;
+    }
+}
+
+// The state is one record in the first block: level, next, entries, entry_bytes, free_overflow, load_factor.
+void HashIndex::read_meta() {
+    SlottedPage *page = file.get(META);
+    u_int16_t size = 0;
+    const char *bytes = page->get_bytes(1, size);
+    if (bytes == nullptr || size != 6 * sizeof(uint32_t)) {
+        delete page;
+        throw DbRelationError("index " + name + " is not a hash index");
+    }
+    uint32_t meta[6];
+    memcpy(meta, bytes, sizeof(meta));
+    delete page;
+    level = meta[0];
+    next = meta[1];
+    entries = meta[2];
+    entry_bytes = meta[3];
+    free_overflow = meta[4];
+    load_factor = meta[5];
+}
+
+void HashIndex::save_meta() {
+    uint32_t meta[6] = {level, next, entries, entry_bytes, free_overflow, load_factor};
+    Dbt dbt(meta, sizeof(meta));
+    SlottedPage *page = file.get(META);
+    if (page->size() == 0)
+        page->add(&dbt);
+    else
+        page->put(1, dbt);
+    file.put(page);
+    delete page;
+}
+
+std::string HashIndex::normalized(const ValueDict *key) const {
+    KeyValue key_value;
+    uint col_num = 0;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column " + column_name + " for index " + name);
+        if (column->second.data_type != key_profile[col_num++])
+            throw DbRelationError("key column " + column_name + " is not of the key type of index " + name);
+        key_value.push_back(column->second);
+    }
+    return BTreeNode::normalize_key(key_profile, &key_value);
+}
+
+// FNV-1a, with the bits mixed afterward since the buckets are picked by the low ones.
+uint32_t HashIndex::hash(const std::string &key) {
+    uint32_t h = 2166136261U;
+    for (unsigned char c: key) {
+        h ^= c;
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    return h;
+}
+
+uint32_t HashIndex::bucket_of(uint32_t hash) const {
+    uint32_t bucket = hash % (INITIAL_BUCKETS << level);
+    if (bucket < next)
+        bucket = hash % (INITIAL_BUCKETS << (level + 1));
+    return bucket;
+}
+
+BlockID HashIndex::get_link(const SlottedPage *page) {
+    u_int16_t size;
+    return *(const BlockID *) page->get_bytes(1, size);
+}
+
+void HashIndex::put_link(SlottedPage *page, BlockID link) {
+    Dbt dbt(&link, sizeof(BlockID));
+    if (page->size() == 0)
+        page->add(&dbt);
+    else
+        page->put(1, dbt);
+}
+
+void HashIndex::free_block(BlockID block_id) {
+    SlottedPage *page = overflow.get(block_id);
+    page->clear();
+    put_link(page, free_overflow);
+    overflow.put(page);
+    delete page;
+    free_overflow = block_id;
+}
+
+void HashIndex::append(uint32_t bucket, const Dbt &entry) {
+    HeapFile *page_file = &file;
+    SlottedPage *page = file.get(bucket + 2);
+    while (page->unused_bytes() < entry.get_size() + 4) {
+        BlockID link = get_link(page);
+        if (link == 0) {
+            // chain is full, so add an overflow block to the end of it
+            SlottedPage *next_page;
+            if (free_overflow != 0) {
+                next_page = overflow.get(free_overflow);
+                free_overflow = get_link(next_page);
+            } else {
+                next_page = overflow.get_new();
+            }
+            next_page->clear();
+            put_link(next_page, 0);
+            put_link(page, next_page->get_block_id());
+            page_file->put(page);
+            delete page;
+            page = next_page;
+            page_file = &overflow;
+            break;
+        }
+        delete page;
+        page = overflow.get(link);
+        page_file = &overflow;
+    }
+    page->add(&entry);
+    page_file->put(page);
+    delete page;
+}
+
+// Add an entry to its bucket, then split a bucket if the buckets are getting too full.
+void HashIndex::add(const std::string &key, Handle handle) {
+    uint32_t h = hash(key);
+    if (ENTRY_HEADER + key.size() > DbBlock::BLOCK_SZ / 2)
+        throw DbRelationError("index key too big to marshal");
+    if (unique) {
+        SlottedPage *page = file.get(bucket_of(h) + 2);
+        while (page != nullptr) {
+            for (RecordID id = 2; id <= page->last_id(); id++) {
+                u_int16_t size;
+                const char *bytes = page->get_bytes(id, size);
+                if (bytes != nullptr && *(const uint32_t *) bytes == h && size == ENTRY_HEADER + key.size() &&
+                    memcmp(bytes + ENTRY_HEADER, key.data(), key.size()) == 0) {
+                    delete page;
+                    throw DbRelationError("Duplicate keys are not allowed in unique index");
+                }
+            }
+            BlockID link = get_link(page);
+            delete page;
+            page = link == 0 ? nullptr : overflow.get(link);
+        }
+    }
+
+    std::string entry((const char *) &h, sizeof(uint32_t));
+    entry.append((const char *) &handle.first, sizeof(BlockID));
+    entry.append((const char *) &handle.second, sizeof(RecordID));
+    entry += key;
+    append(bucket_of(h), Dbt((void *) entry.data(), (u_int32_t) entry.size()));
+    entries++;
+    entry_bytes += (uint32_t) entry.size();
+
+    // each bucket block holds BLOCK_SZ less its headers and link; each entry takes a record header too
+    const u_long bucket_space = DbBlock::BLOCK_SZ - 1 - 4 - 8;
+    if (entry_bytes + 4UL * entries > (u_long) get_bucket_count() * bucket_space * load_factor / 100)
+        split();
+}
+
+// Split the bucket at the split pointer: its entries stay, or move to the new bucket at the end, by the next bit
+// of their hash.
+void HashIndex::split() {
+    uint32_t from = next;
+    SlottedPage *new_page = file.get_new();
+    if (new_page->get_block_id() != get_bucket_count() + 2) {
+        delete new_page;
+        throw DbRelationError("hash index " + name + " has lost track of its buckets");
+    }
+    put_link(new_page, 0);
+    file.put(new_page);
+    delete new_page;
+    if (++next == INITIAL_BUCKETS << level) {
+        level++;
+        next = 0;
+    }
+
+    // take all the entries out of the old chain, freeing its overflow blocks, then put each where it goes now
+    std::vector<std::string> moving;
+    SlottedPage *page = file.get(from + 2);
+    BlockID link = get_link(page);
+    for (RecordID id = 2; id <= page->last_id(); id++) {
+        u_int16_t size;
+        const char *bytes = page->get_bytes(id, size);
+        if (bytes != nullptr)
+            moving.push_back(std::string(bytes, size));
+    }
+    page->clear();
+    put_link(page, 0);
+    file.put(page);
+    delete page;
+    while (link != 0) {
+        page = overflow.get(link);
+        for (RecordID id = 2; id <= page->last_id(); id++) {
+            u_int16_t size;
+            const char *bytes = page->get_bytes(id, size);
+            if (bytes != nullptr)
+                moving.push_back(std::string(bytes, size));
+        }
+        BlockID next_link = get_link(page);
+        delete page;
+        free_block(link);
+        link = next_link;
+    }
+    for (auto const &entry: moving)
+        append(bucket_of(*(const uint32_t *) entry.data()), Dbt((void *) entry.data(), (u_int32_t) entry.size()));
+}
+
+Handles *HashIndex::lookup(ValueDict *key_dict) const {
+    std::string key = normalized(key_dict);
+    uint32_t h = hash(key);
+    Handles *handles = new Handles();
+    HeapFile *page_file = const_cast<HeapFile *>(&file);
+    SlottedPage *page = page_file->get(bucket_of(h) + 2);
+    while (page != nullptr) {
+        for (RecordID id = 2; id <= page->last_id(); id++) {
+            u_int16_t size;
+            const char *bytes = page->get_bytes(id, size);
+            if (bytes != nullptr && *(const uint32_t *) bytes == h && size == ENTRY_HEADER + key.size() &&
+                memcmp(bytes + ENTRY_HEADER, key.data(), key.size()) == 0)
+                handles->push_back(Handle(*(const BlockID *) (bytes + sizeof(uint32_t)),
+                                          *(const RecordID *) (bytes + sizeof(uint32_t) + sizeof(BlockID))));
+        }
+        BlockID link = get_link(page);
+        delete page;
+        page = link == 0 ? nullptr : const_cast<HeapFile &>(overflow).get(link);
+    }
+    return handles;
+}
+
+void HashIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    std::string key = normalized(row);
+    add(key, handle);
+    save_meta();
+}
+
+void HashIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    std::string key = normalized(row);
+    uint32_t h = hash(key);
+    HeapFile *page_file = &file;
+    SlottedPage *page = file.get(bucket_of(h) + 2);
+    while (page != nullptr) {
+        for (RecordID id = 2; id <= page->last_id(); id++) {
+            u_int16_t size;
+            const char *bytes = page->get_bytes(id, size);
+            if (bytes != nullptr && *(const uint32_t *) bytes == h &&
+                *(const BlockID *) (bytes + sizeof(uint32_t)) == handle.first &&
+                *(const RecordID *) (bytes + sizeof(uint32_t) + sizeof(BlockID)) == handle.second) {
+                page->erase(id);
+                page_file->put(page);
+                delete page;
+                entries--;
+                entry_bytes -= (uint32_t) (ENTRY_HEADER + key.size());
+                save_meta();
+                return;
+            }
+        }
+        BlockID link = get_link(page);
+        delete page;
+        page = link == 0 ? nullptr : overflow.get(link);
+        page_file = &overflow;
+    }
+    throw DbRelationError("key to delete not found in index");
+}
+
+
+/**
+ * Test helper. A unique index on keys so long that buckets chain into overflow
+ * blocks still turns away a repeat of every key, wherever in its chain it is.
+ * @return true if the tests all succeeded
+ */
+static bool test_hash_overflow() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_hash_overflow", column_names, column_attributes);
+    table.create();
+    HashIndex index(table, "hashoverflow", ColumnNames(1, "b"), true);
+    index.create();
+    Handles handles;
+    for (int i = 0; i < 400; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(std::to_string(i) + std::string(600, 'x'));
+        handles.push_back(table.insert(&row));
+        index.insert(handles.back());
+    }
+    bool ok = index.get_overflow_count() > 0 || assertion_failure("no overflow blocks");
+    uint accepted = 0;
+    for (auto const &handle: handles) {
+        try {
+            index.insert(handle);
+            accepted++;
+        } catch (DbRelationError &e) {
+        }
+    }
+    ok = ok && (accepted == 0 || assertion_failure("hash index took duplicates in overflow", accepted));
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+/**
+ * Testing function for the hash index.
+ * @return true if the tests all succeeded
+ */
+bool test_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_hash_index", column_names, column_attributes);
+    table.create();
+    const int rows = 20 * 1000, keys = 500;
+    Handles handles;
+    auto b_of = [](int i) { return "key number " + std::to_string(i % keys); };
+    for (int i = 0; i < rows / 2; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(b_of(i));
+        handles.push_back(table.insert(&row));
+    }
+
+    // non-unique on b, half built by create and half by inserts
+    HashIndex index(table, "hashindex", ColumnNames(1, "b"), false);
+    index.create();
+    for (int i = rows / 2; i < rows; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(b_of(i));
+        handles.push_back(table.insert(&row));
+        index.insert(handles.back());
+    }
+    bool ok = index.get_bucket_count() > HashIndex::INITIAL_BUCKETS * 8 ||
+              assertion_failure("buckets didn't grow", index.get_bucket_count());
+    ValueDict key;
+    for (int k = 0; ok && k < keys; k += 7) {
+        key["b"] = Value(b_of(k));
+        Handles *found = index.lookup(&key);
+        if (found->size() != (u_long) rows / keys)
+            ok = assertion_failure("hash lookup", k, found->size());
+        for (auto const &handle: *found) {
+            ValueDict *row = table.project(handle);
+            if ((*row)["b"].s != b_of(k))
+                ok = assertion_failure("hash lookup found the wrong row", k);
+            delete row;
+        }
+        delete found;
+    }
+    key["b"] = Value("no such key");
+    Handles *found = index.lookup(&key);
+    ok = ok && (found->empty() || assertion_failure("hash lookup of a missing key"));
+    delete found;
+    key["b"] = Value(keys);
+    try {
+        delete index.lookup(&key);
+        ok = assertion_failure("hash lookup with an INT key not rejected");
+    } catch (DbRelationError &e) {
+    }
+
+    // delete every other row, then reopen the index from its file
+    for (int i = 0; i < rows; i += 2) {
+        index.del(handles[i]);
+        table.del(handles[i]);
+    }
+    index.close();
+    index.open();
+    key["b"] = Value(b_of(1));
+    found = index.lookup(&key);
+    ok = ok && (found->size() == (u_long) rows / keys || assertion_failure("hash lookup after deletes", found->size()));
+    delete found;
+    key["b"] = Value(b_of(2));
+    found = index.lookup(&key);
+    ok = ok && (found->empty() || assertion_failure("hash lookup of deleted keys", found->size()));
+    delete found;
+
+    // unique on a, which rejects a repeat
+    HashIndex unique_index(table, "hashunique", ColumnNames(1, "a"), true);
+    unique_index.create();
+    ValueDict repeat;
+    repeat["a"] = Value(1);
+    repeat["b"] = Value("repeat");
+    Handle repeat_handle = table.insert(&repeat);
+    try {
+        unique_index.insert(repeat_handle);
+        ok = assertion_failure("hash index took a duplicate key");
+    } catch (DbRelationError &e) {
+    }
+    key.clear();
+    key["a"] = Value(rows - 1);
+    found = unique_index.lookup(&key);
+    ok = ok && (found->size() == 1 || assertion_failure("unique hash lookup", found->size()));
+    delete found;
+
+    // a unique-key probe (as SQLExec::insert does) through another object for the same index, opened from its file
+    unique_index.close();
+    HashIndex reopened(table, "hashunique", ColumnNames(1, "a"), true);
+    reopened.open();
+    ok = ok && (reopened.contains(&key) || assertion_failure("probe of a reopened hash index missed"));
+    key["a"] = Value(rows);
+    ok = ok && (!reopened.contains(&key) || assertion_failure("probe of a reopened hash index found a missing key"));
+    reopened.close();
+    unique_index.open();
+
+    unique_index.drop();
+    index.drop();
+    table.drop();
+    return ok && test_hash_overflow();
+}
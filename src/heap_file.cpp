@@ -19,6 +19,15 @@ HeapFile::HeapFile(string name)
     this->dbfilename = this->name + ".db";
 }
 
+/**
+ * Destructor. Writes back any changes still sitting in the buffer pool.
+ */
+HeapFile::~HeapFile() {
+    if (!this->closed)
+        BufferPool::instance().flush(this);
+    BufferPool::instance().discard(this);
+}
+
 /**
  * Create physical file.
  */
@@ -32,6 +41,7 @@ void HeapFile::create(void) {
  * Delete the physical file.
  */
 void HeapFile::drop(void) {
+    BufferPool::instance().discard(this);
     close();
     Db db(_DB_ENV, 0);
     db.remove(this->dbfilename.c_str(), nullptr, 0);
@@ -46,6 +56,8 @@ void HeapFile::open(void) { db_open(); }
  * Close the physical file.
  */
 void HeapFile::close(void) {
+    BufferPool::instance().flush(this);
+    BufferPool::instance().discard(this);
     this->db.close(0);
     this->closed = true;
 }
@@ -56,43 +68,34 @@ void HeapFile::close(void) {
  * its block id.
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+    BlockID block_id = ++this->last;
+    BufferFrame *frame = BufferPool::instance().pin_new(this, block_id);
+    Dbt data(frame->get_data(), DbBlock::BLOCK_SZ);
+    SlottedPage *page = new SlottedPage(data, block_id, true, frame);
 
-    // write out an empty block and read it back in so Berkeley DB is managing
-    // the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data,
-                 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    // write it out with initialization done to it, so the file's block count stays right
+    write_block(block_id, frame->get_data());
+    return page;
 }
 
 /**
  * Get a block from the database file.
  * @param block_id
- * @return          the given slotted page (freed by caller)
+ * @return          the given slotted page, pinned in the buffer pool (freed by caller)
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
-    Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    BufferFrame *frame = BufferPool::instance().pin(this, block_id);
+    Dbt data(frame->get_data(), DbBlock::BLOCK_SZ);
+    return new SlottedPage(data, block_id, false, frame);
 }
 
 /**
- * Write a block back to the database file.
+ * Write a block back to the database file. The change is held in the buffer
+ * pool and reaches the file when its frame is evicted or flushed.
  * @param block
  */
 void HeapFile::put(DbBlock *block) {
-    int block_id = block->get_block_id();
-    Dbt key(&block_id, sizeof(block_id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    BufferPool::instance().put(this, block->get_block_id(), block->get_data());
 }
 
 /**
@@ -106,6 +109,33 @@ BlockIDs *HeapFile::block_ids() const {
     return vec;
 }
 
+/**
+ * @class HeapFileBlocks - counts through the block ids of a heap file
+ */
+class HeapFileBlocks : public BlockIterator {
+  public:
+    HeapFileBlocks(BlockID last) : block_id(0), last(last) {}
+
+    virtual bool next(BlockID &block_id) {
+        if (this->block_id >= this->last)
+            return false;
+        block_id = ++this->block_id;
+        return true;
+    }
+
+  protected:
+    BlockID block_id;
+    BlockID last;
+};
+
+/**
+ * Iterate over all block ids (those there are when the iteration starts).
+ * @return block ids (freed by caller)
+ */
+BlockIterator *HeapFile::blocks() const {
+    return new HeapFileBlocks(this->last);
+}
+
 /**
  * Ask BerkDb how many blocks we are currently using in the file.
  * @return number of blocks
@@ -118,6 +148,30 @@ uint32_t HeapFile::get_block_count() {
     return bt_ndata;
 }
 
+/**
+ * Read a block from Berkeley DB straight into the caller's buffer.
+ * @param block_id  which block
+ * @param buffer    BLOCK_SZ bytes to fill (a buffer pool frame)
+ */
+void HeapFile::read_block(BlockID block_id, void *buffer) {
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data(buffer, DbBlock::BLOCK_SZ);
+    data.set_ulen(DbBlock::BLOCK_SZ);
+    data.set_flags(DB_DBT_USERMEM);
+    this->db.get(nullptr, &key, &data, 0);
+}
+
+/**
+ * Write a block to Berkeley DB.
+ * @param block_id  which block
+ * @param buffer    the block's BLOCK_SZ bytes
+ */
+void HeapFile::write_block(BlockID block_id, const void *buffer) {
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data(const_cast<void *>(buffer), DbBlock::BLOCK_SZ);
+    this->db.put(nullptr, &key, &data, 0);
+}
+
 /**
  * Wrapper for Berkeley DB open, which does both open and creation.
  * @param flags BerkDb flags
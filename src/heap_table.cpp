@@ -4,6 +4,10 @@
  * @see Seattle University, CPSC5300
  */
 #include "heap_table.h"
+#include "column_batch.h"
+#include "simd_filter.h"
+#include "parallel_scan.h"
+#include <algorithm>
 #include <cstring>
 
 using namespace std;
@@ -60,8 +64,14 @@ void HeapTable::close() { file.close(); }
  */
 Handle HeapTable::insert(const ValueDict *row) {
     open();
-    ValueDict *full_row = validate(row);
-    Handle handle = append(full_row);
+    Row *full_row = validate(row);
+    Handle handle;
+    try {
+        handle = append(full_row);
+    } catch (...) {
+        delete full_row;
+        throw;
+    }
     delete full_row;
     return handle;
 }
@@ -101,26 +111,259 @@ Handles *HeapTable::select() { return select(nullptr); }
 
 /**
  * The select command
+ *
+ * The where-clause is evaluated directly against the marshaled records of each
+ * block as we walk the file, so each block is fetched only once no matter how
+ * many records it holds.
  * @param where predicates to match
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
-    open();
+    return select(where, nullptr);
+}
+
+/**
+ * The select command with range predicates as well as equality ones
+ * @param where   equality predicates to match (may be nullptr)
+ * @param ranges  range predicates to match (may be nullptr)
+ * @return        list of handles of the selected rows
+ */
+Handles *HeapTable::select(const ValueDict *where, const ValueRanges *ranges) {
     Handles *handles = new Handles();
-    BlockIDs *block_ids = file.block_ids();
-    for (auto const &block_id : *block_ids) {
-        SlottedPage *block = file.get(block_id);
-        RecordIDs *record_ids = block->ids();
-        for (auto const &record_id : *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(Handle(block_id, record_id));
+    HandleIterator *scan = this->scan(where, ranges);
+    Handle handle;
+    while (scan->next(handle))
+        handles->push_back(handle);
+    delete scan;
+    return handles;
+}
+
+/**
+ * @class HeapTableScan - walks a heap table's blocks, yielding the handles of
+ * the records that satisfy the where-clause. Only the current block is held
+ * (pinned) at any time.
+ */
+class HeapTableScan : public HandleIterator {
+  public:
+    HeapTableScan(HeapTable &table, const ValueDict *where, const ValueRanges *ranges)
+            : table(table), where(where), ranges(ranges), blocks(table.file.blocks()), block(nullptr),
+              record_ids(nullptr), i(0) {}
+
+    virtual ~HeapTableScan() {
+        release();
+        delete blocks;
+    }
+
+    virtual bool next(Handle &handle) {
+        while (true) {
+            while (record_ids != nullptr && i < record_ids->size()) {
+                RecordID record_id = (*record_ids)[i++];
+                if (table.selected(block, record_id, where, ranges)) {
+                    handle = Handle(block->get_block_id(), record_id);
+                    return true;
+                }
+            }
+            release();
+            BlockID block_id;
+            if (!blocks->next(block_id))
+                return false;
+            block = table.file.get(block_id);
+            record_ids = block->ids();
+            i = 0;
         }
+    }
+
+    // the block holding the record from the latest call to next()
+    SlottedPage *current_block() const { return block; }
+
+  protected:
+    HeapTable &table;
+    const ValueDict *where;
+    const ValueRanges *ranges;
+    BlockIterator *blocks;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    u_long i;
+
+    void release() {
         delete record_ids;
+        record_ids = nullptr;
         delete block;
+        block = nullptr;
     }
-    delete block_ids;
-    return handles;
+};
+
+/**
+ * @class HeapTableRows - projects each qualifying record straight from the
+ * block the scan is holding, so no block is fetched twice.
+ */
+class HeapTableRows : public RowIterator {
+  public:
+    HeapTableRows(HeapTable &table, const ColumnNames *column_names, const ValueDict *where,
+                  const ValueRanges *ranges, QueryArena *arena) : table(table),
+                                                                  positions(table.positions(column_names)),
+                                                                  handles(table, where, ranges), arena(arena) {}
+
+    virtual bool next(Row *&row) {
+        Handle handle;
+        if (!handles.next(handle))
+            return false;
+        SlottedPage *block = handles.current_block();
+        u16 size;
+        const char *bytes = block->get_bytes(handle.second, size);
+        row = table.project(bytes, size, block->get_format(), positions, arena);
+        return true;
+    }
+
+  protected:
+    HeapTable &table;
+    std::vector<uint> positions;
+    HeapTableScan handles;
+    QueryArena *arena;
+};
+
+/**
+ * @class HeapTableBatches - walks a run of a heap table's blocks, decoding the
+ * wanted columns of each record straight into a ColumnBatch. Columns after the
+ * last wanted one are not even looked at.
+ */
+class HeapTableBatches : public BatchScan {
+  public:
+    HeapTableBatches(HeapTable &table, const ColumnNames *column_names, BlockID first, BlockID last)
+            : table(table), targets(), last_needed(0), next_block(first), last_block(last), block(nullptr),
+              record_ids(nullptr), i(0) {
+        for (auto const &column_name : table.column_names) {
+            int target = -1;
+            for (uint j = 0; j < column_names->size(); j++)
+                if ((*column_names)[j] == column_name)
+                    target = (int) j;
+            targets.push_back(target);
+            if (target >= 0)
+                last_needed = (uint) targets.size();
+        }
+    }
+
+    virtual ~HeapTableBatches() {
+        release();
+    }
+
+    virtual bool next(ColumnBatch &batch) {
+        batch.clear();
+        while (batch.size < ColumnBatch::CAPACITY) {
+            if (record_ids == nullptr || i >= record_ids->size()) {
+                release();
+                if (next_block > last_block)
+                    break;
+                block = table.file.get(next_block++);
+                record_ids = block->ids();
+                i = 0;
+                continue;
+            }
+            u16 size;
+            const char *bytes = block->get_bytes((*record_ids)[i++], size);
+            if (block->get_format() == HeapTable::ROW_V2)
+                decode_v2(bytes, size, batch, batch.size++);
+            else
+                decode(bytes, batch, batch.size++);
+        }
+        batch.select_all();
+        return batch.size > 0;
+    }
+
+  protected:
+    HeapTable &table;
+    std::vector<int> targets;  // batch column for each table column, or -1 if not wanted
+    uint last_needed;          // one past the last table column that is wanted
+    BlockID next_block;
+    BlockID last_block;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    u_long i;
+
+    void decode(const char *bytes, ColumnBatch &batch, uint row) {
+        uint offset = 0;
+        for (uint col_num = 0; col_num < last_needed; col_num++) {
+            ColumnAttribute ca = table.column_attributes[col_num];
+            int target = targets[col_num];
+            switch (ca.get_data_type()) {
+                case ColumnAttribute::INT:
+                    if (target >= 0)
+                        batch.columns[target]->ints[row] = *(int32_t *) (bytes + offset);
+                    offset += sizeof(int32_t);
+                    break;
+                case ColumnAttribute::TEXT: {
+                    u16 size = *(u16 *) (bytes + offset);
+                    offset += sizeof(u16);
+                    if (target >= 0)
+                        batch.columns[target]->put_text(row, bytes + offset, size);
+                    offset += size;
+                    break;
+                }
+                case ColumnAttribute::BOOLEAN:
+                    if (target >= 0)
+                        batch.columns[target]->ints[row] = *(uint8_t *) (bytes + offset);
+                    offset += sizeof(uint8_t);
+                    break;
+                default:
+                    throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+            }
+        }
+    }
+
+    // the wanted columns of a ROW_V2 record, each gotten to directly
+    void decode_v2(const char *bytes, u16 record_size, ColumnBatch &batch, uint row) {
+        for (uint col_num = 0; col_num < last_needed; col_num++) {
+            int target = targets[col_num];
+            if (target < 0)
+                continue;
+            u16 size;
+            const char *value = table.field(bytes, record_size, col_num, size);
+            if (value == nullptr)
+                throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+            ColumnAttribute ca = table.column_attributes[col_num];
+            if (ca.get_data_type() == ColumnAttribute::TEXT)
+                batch.columns[target]->put_text(row, value, size);
+            else if (ca.get_data_type() == ColumnAttribute::INT)
+                batch.columns[target]->ints[row] = *(int32_t *) value;
+            else
+                batch.columns[target]->ints[row] = *(uint8_t *) value;
+        }
+    }
+
+    void release() {
+        delete record_ids;
+        record_ids = nullptr;
+        delete block;
+        block = nullptr;
+    }
+};
+
+/**
+ * Stream the handles of the rows matching the where-clause.
+ * @param where   equality predicates to match (may be nullptr)
+ * @param ranges  range predicates to match (may be nullptr)
+ * @return        iterator over handles of the selected rows (freed by caller)
+ */
+HandleIterator *HeapTable::scan(const ValueDict *where, const ValueRanges *ranges) {
+    open();
+    check_columns(where, ranges);
+    return new HeapTableScan(*this, where, ranges);
+}
+
+/**
+ * Stream the rows matching the where-clause, projected to column_names.
+ * @param column_names  columns to include in each row (all if empty)
+ * @param where         equality predicates to match (may be nullptr)
+ * @param ranges        range predicates to match (may be nullptr)
+ * @param arena         where to keep the rows' values (the heap if nullptr)
+ * @return              iterator over the projected rows (freed by caller)
+ */
+RowIterator *HeapTable::rows(const ColumnNames *column_names, const ValueDict *where, const ValueRanges *ranges,
+                             QueryArena *arena) {
+    open();
+    check_columns(where, ranges);
+    check_columns(column_names);
+    return new HeapTableRows(*this, column_names, where, ranges, arena);
 }
 
 /**
@@ -131,10 +374,45 @@ Handles *HeapTable::select(const ValueDict *where) {
  * @return                  list of handles of the selected rows
  */
 Handles *HeapTable::select(Handles *current_selection, const ValueDict *where) {
+    return select(current_selection, where, nullptr);
+}
+
+/**
+ * Refine another selection with range predicates as well as equality ones. As
+ * in project_rows, the handles are grouped by block so each block is fetched
+ * only once.
+ *
+ * @param current_selection range of handles to filter
+ * @param where             equality predicates to match (may be nullptr)
+ * @param ranges            range predicates to match (may be nullptr)
+ * @return                  list of handles of the selected rows, in the same order as current_selection
+ */
+Handles *HeapTable::select(Handles *current_selection, const ValueDict *where, const ValueRanges *ranges) {
+    if (where == nullptr && ranges == nullptr)
+        return new Handles(*current_selection);
+    check_columns(where, ranges);
+
+    map<BlockID, vector<u_long>> positions_by_block;
+    for (u_long i = 0; i < current_selection->size(); i++)
+        positions_by_block[(*current_selection)[i].first].push_back(i);
+
+    vector<bool> keep(current_selection->size(), false);
+    for (auto const &block_positions : positions_by_block) {
+        SlottedPage *block = file.get(block_positions.first);
+        try {
+            for (auto const &i : block_positions.second)
+                keep[i] = selected(block, (*current_selection)[i].second, where, ranges);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+
     Handles *handles = new Handles();
-    for (auto const &handle: *current_selection)
-        if (selected(handle, where))
-            handles->push_back(handle);
+    for (u_long i = 0; i < current_selection->size(); i++)
+        if (keep[i])
+            handles->push_back((*current_selection)[i]);
     return handles;
 }
 
@@ -154,22 +432,144 @@ ValueDict *HeapTable::project(Handle handle) {
  * @return a sequence of values for handle given by column_names
  */
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
+    const ColumnNames *names = column_names->empty() ? &this->column_names : column_names;
+    std::vector<uint> positions = this->positions(names);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
+    u16 size;
+    const char *bytes = block->get_bytes(record_id, size);
+    if (bytes == nullptr) {
+        delete block;
+        throw DbRelationError("no row for handle in table " + this->table_name);
+    }
+    Row *row;
+    try {
+        row = project(bytes, size, block->get_format(), positions);
+    } catch (...) {
+        delete block;
+        throw;
+    }
     delete block;
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
+    ValueDict *ret = to_value_dict(*names, *row);
+    delete row;
+    return ret;
+}
+
+/**
+ * Project given columns from each of a list of rows.
+ * @param handles       rows to be projected
+ * @param column_names  of columns to be included in the result
+ * @return a row for each handle, in the same order as handles (freed by caller)
+ */
+ValueDicts *HeapTable::project(Handles *handles, const ColumnNames *column_names) {
+    const ColumnNames *names = column_names->empty() ? &this->column_names : column_names;
+    Rows *rows = project_rows(handles, names);
+    ValueDicts *ret = new ValueDicts();
+    for (auto row : *rows) {
+        ret->push_back(to_value_dict(*names, *row));
+        delete row;
+    }
+    delete rows;
+    return ret;
+}
+
+/**
+ * Project given columns, by position, from each of a list of rows. The handles
+ * are grouped by block so each block is fetched only once, no matter how many
+ * of its records are wanted.
+ * @param handles       rows to be projected
+ * @param column_names  of columns to be included in the result (all if empty)
+ * @param arena         where to keep the rows' values (the heap if nullptr)
+ * @return a row for each handle, in the same order as handles (freed by caller)
+ */
+Rows *HeapTable::project_rows(Handles *handles, const ColumnNames *column_names, QueryArena *arena) {
+    std::vector<uint> positions = this->positions(column_names);
+
+    map<BlockID, vector<u_long>> positions_by_block;
+    for (u_long i = 0; i < handles->size(); i++)
+        positions_by_block[(*handles)[i].first].push_back(i);
+
+    Rows *rows = new Rows(handles->size(), nullptr);
+    for (auto const &block_positions : positions_by_block) {
+        SlottedPage *block = file.get(block_positions.first);
+        for (auto const &i : block_positions.second) {
+            u16 size;
+            const char *bytes = block->get_bytes((*handles)[i].second, size);
+            if (bytes == nullptr) {
+                delete block;
+                for (auto row : *rows)
+                    delete row;
+                delete rows;
+                throw DbRelationError("no row for handle in table " + this->table_name);
+            }
+            (*rows)[i] = project(bytes, size, block->get_format(), positions, arena);
+        }
+        delete block;
+    }
+    return rows;
+}
+
+/**
+ * Figure out where each of the given columns is in a record.
+ * @param column_names  of columns wanted (all if empty)
+ * @return              the position of each in column_names order
+ * @throws DbRelationError if one of them is not in this table
+ */
+std::vector<uint> HeapTable::positions(const ColumnNames *column_names) const {
+    std::vector<uint> ret;
+    if (column_names->empty()) {
+        for (uint i = 0; i < this->column_names.size(); i++)
+            ret.push_back(i);
+        return ret;
+    }
     for (auto const &column_name : *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" +
-                                  column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+        auto it = find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        ret.push_back((uint) (it - this->column_names.begin()));
     }
+    return ret;
+}
+
+/**
+ * Project given columns from a marshaled row. Only the wanted columns of a
+ * ROW_V2 record are decoded; of a ROW_V1 record, those up to the last one
+ * wanted.
+ * @param bytes      the row as stored in its block
+ * @param size       its size
+ * @param format     the block's format
+ * @param positions  of the columns to be included in the result, in order
+ * @param arena      where to keep the values (the heap if nullptr)
+ * @return the values for the given columns, in order (freed by caller)
+ */
+Row *HeapTable::project(const char *bytes, u16 size, uint16_t format, const std::vector<uint> &positions,
+                        QueryArena *arena) const {
+    if (format == ROW_V2) {
+        Row *row = new Row(ArenaAllocator<Value>(arena));
+        row->reserve(positions.size());
+        try {
+            for (auto position : positions)
+                row->push_back(unmarshal(bytes, size, position));
+        } catch (...) {
+            delete row;
+            throw;
+        }
+        return row;
+    }
+    uint columns = 0;
+    bool in_order = true;
+    for (uint i = 0; i < positions.size(); i++) {
+        columns = max(columns, positions[i] + 1);
+        in_order = in_order && positions[i] == i;
+    }
+    Row *row = unmarshal(bytes, columns);
+    if (in_order && columns == positions.size())
+        return row;
+    Row *result = new Row(ArenaAllocator<Value>(arena));
+    result->reserve(positions.size());
+    for (auto position : positions)
+        result->push_back((*row)[position]);
     delete row;
     return result;
 }
@@ -177,20 +577,20 @@ ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
 /**
  * Check if the given row is acceptable to insert.
  * @param row to be validated
- * @return the full row dictionary
+ * @return the full row, in column order
  * @throws DbRelationError if not valid
  */
-ValueDict *HeapTable::validate(const ValueDict *row) const {
-    ValueDict *full_row = new ValueDict();
+Row *HeapTable::validate(const ValueDict *row) const {
+    Row *full_row = new Row();
+    full_row->reserve(this->column_names.size());
     for (auto const &column_name : this->column_names) {
-        Value value;
         ValueDict::const_iterator column = row->find(column_name);
-        if (column == row->end())
+        if (column == row->end()) {
+            delete full_row;
             throw DbRelationError(
                 "don't know how to handle NULLs, defaults, etc. yet");
-        else
-            value = column->second;
-        (*full_row)[column_name] = value;
+        }
+        full_row->push_back(column->second);
     }
     return full_row;
 }
@@ -200,16 +600,23 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
  * @param row to be appended
  * @return handle of newly inserted row
  */
-Handle HeapTable::append(const ValueDict *row) {
+Handle HeapTable::append(const Row *row) {
     Dbt *data = marshal(row);
     SlottedPage *block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
-    try {
-        record_id = block->add(data);
-    } catch (DbBlockNoRoomError &e) {
-        // need a new block
+    if (block->get_format() != ROW_V2 && block->last_id() == 0)
+        block->set_format(ROW_V2);  // never used, so it can take the new format
+    RecordID record_id = 0;
+    if (block->get_format() == ROW_V2) {
+        try {
+            record_id = block->add(data);
+        } catch (DbBlockNoRoomError &e) {
+        }
+    }
+    if (record_id == 0) {
+        // need a new block (this one is full, or holds ROW_V1 records)
         delete block;
         block = this->file.get_new();
+        block->set_format(ROW_V2);
         record_id = block->add(data);
     }
     this->file.put(block);
@@ -220,48 +627,56 @@ Handle HeapTable::append(const ValueDict *row) {
 }
 
 /**
- * Figure out the bits to go into the file.
+ * Figure out the bits to go into the file: a ROW_V2 record. That is a 2-byte
+ * offset (from the start of the record) to each column's value, then a bitmap
+ * with a bit set for each NULL column, then the values. INT and BOOLEAN values
+ * are 4 and 1 bytes; a TEXT value runs to the next column's offset (or the end
+ * of the record).
  * The caller is responsible for freeing the returned Dbt and its enclosed
  * ret->get_data().
- * @param row data for the tuple
+ * @param row data for the tuple, in column order
  * @return bits of the record as it should appear on disk
  */
-Dbt *HeapTable::marshal(const ValueDict *row) const {
+Dbt *HeapTable::marshal(const Row *row) const {
+    uint n = (uint) this->column_names.size();
+    uint null_bitmap = n * sizeof(u16);
+    uint offset = null_bitmap + (n + 7) / 8;
+    if (offset > DbBlock::BLOCK_SZ)
+        throw DbRelationError("row too big to marshal");
     char *bytes =
         new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one
                                      // row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name : this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
+    memset(bytes + null_bitmap, 0, offset - null_bitmap); // no NULLs yet
+    try {
+        for (uint col_num = 0; col_num < n; col_num++) {
+            ColumnAttribute ca = this->column_attributes[col_num];
+            const Value &value = (*row)[col_num];
+            *(u16 *)(bytes + col_num * sizeof(u16)) = (u16)offset;
 
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("row too big to marshal");
-            *(int32_t *)(bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u_long size = value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("row too big to marshal");
-            *(u16 *)(bytes + offset) = size;
-            offset += sizeof(u16);
-            memcpy(bytes + offset, value.s.c_str(),
-                   size); // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("row too big to marshal");
-            *(uint8_t *)(bytes + offset) = (uint8_t)value.n;
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError(
-                "Only know how to marshal INT, TEXT, and BOOLEAN");
+            if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+                if (offset + 4 > DbBlock::BLOCK_SZ)
+                    throw DbRelationError("row too big to marshal");
+                *(int32_t *)(bytes + offset) = value.n;
+                offset += sizeof(int32_t);
+            } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+                u_long size = value.s.length();
+                if (offset + size > DbBlock::BLOCK_SZ)
+                    throw DbRelationError("row too big to marshal");
+                memcpy(bytes + offset, value.s.data(), size); // assume ascii for now
+                offset += size;
+            } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
+                if (offset + 1 > DbBlock::BLOCK_SZ)
+                    throw DbRelationError("row too big to marshal");
+                *(uint8_t *)(bytes + offset) = (uint8_t)value.n;
+                offset += sizeof(uint8_t);
+            } else {
+                throw DbRelationError(
+                    "Only know how to marshal INT, TEXT, and BOOLEAN");
+            }
         }
+    } catch (...) {
+        delete[] bytes;
+        throw;
     }
     char *right_size_bytes = new char[offset];
     memcpy(right_size_bytes, bytes, offset);
@@ -272,57 +687,292 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
 
 /**
  * Figure out the memory data structures from the given bits gotten from the
- * file.
- * @param data file data for the tuple
- * @return row data for the tuple
+ * file, for a ROW_V1 record.
+ * @param bytes    file data for the tuple
+ * @param columns  how many of the leading columns to decode
+ * @return row data for the tuple, in column order
  */
-ValueDict *HeapTable::unmarshal(Dbt *data) const {
-    ValueDict *row = new ValueDict();
-    Value value;
-    char *bytes = (char *)data->get_data();
+Row *HeapTable::unmarshal(const char *bytes, uint columns) const {
+    Row *row = new Row(columns);
     uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name : this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
+    for (uint col_num = 0; col_num < columns; col_num++) {
+        ColumnAttribute ca = this->column_attributes[col_num];
+        Value &value = (*row)[col_num];
         value.data_type = ca.get_data_type();
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+        if (value.data_type == ColumnAttribute::DataType::INT) {
             value.n = *(int32_t *)(bytes + offset);
             offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+        } else if (value.data_type == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16 *)(bytes + offset);
             offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer); // assume ascii for now
+            value.s.assign(bytes + offset, size); // assume ascii for now
             offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
+        } else if (value.data_type == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *)(bytes + offset);
             offset += sizeof(uint8_t);
         } else {
+            delete row;
             throw DbRelationError(
                 "Only know how to unmarshal INT, TEXT, and BOOLEAN");
         }
-        (*row)[column_name] = value;
     }
     return row;
 }
 
+/**
+ * Find a column's value in a ROW_V2 record.
+ * @param bytes        the record
+ * @param record_size  its size
+ * @param col_num      which column
+ * @param size         set to the size of the value
+ * @return             the value's first byte, or nullptr if it is NULL
+ */
+const char *HeapTable::field(const char *bytes, u16 record_size, uint col_num, u16 &size) const {
+    uint n = (uint) this->column_names.size();
+    if ((bytes[n * sizeof(u16) + col_num / 8] >> (col_num % 8)) & 1)
+        return nullptr;
+    u16 offset = *(const u16 *)(bytes + col_num * sizeof(u16));
+    u16 end = col_num + 1 < n ? *(const u16 *)(bytes + (col_num + 1) * sizeof(u16)) : record_size;
+    size = end - offset;
+    return bytes + offset;
+}
+
+/**
+ * Get one column's value out of a ROW_V2 record, without looking at the others.
+ * @param bytes        the record
+ * @param record_size  its size
+ * @param col_num      which column
+ * @return             the value
+ */
+Value HeapTable::unmarshal(const char *bytes, u16 record_size, uint col_num) const {
+    u16 size;
+    const char *value_bytes = field(bytes, record_size, col_num, size);
+    if (value_bytes == nullptr)
+        throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+    ColumnAttribute ca = this->column_attributes[col_num];
+    Value value;
+    value.data_type = ca.get_data_type();
+    if (value.data_type == ColumnAttribute::DataType::INT)
+        value.n = *(const int32_t *)value_bytes;
+    else if (value.data_type == ColumnAttribute::DataType::TEXT)
+        value.s.assign(value_bytes, size);
+    else if (value.data_type == ColumnAttribute::DataType::BOOLEAN)
+        value.n = *(const uint8_t *)value_bytes;
+    else
+        throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+    return value;
+}
+
+/**
+ * Scan all the rows a ColumnBatch at a time.
+ * @param column_names  columns to load into each batch, in batch column order
+ * @return              the batch scan (freed by caller)
+ */
+BatchScan *HeapTable::batches(const ColumnNames *column_names) {
+    open();
+    check_columns(column_names);
+    return new HeapTableBatches(*this, column_names, 1, this->file.get_last_block_id());
+}
+
+/**
+ * Number of morsels the table's blocks make (the last one may be short).
+ * @param blocks_per_morsel  blocks in each morsel
+ * @return                   number of morsels
+ */
+uint HeapTable::morsel_count(uint blocks_per_morsel) {
+    open();
+    return (this->file.get_last_block_id() + blocks_per_morsel - 1) / blocks_per_morsel;
+}
+
+/**
+ * Scan the rows of one morsel a ColumnBatch at a time.
+ * @param column_names       columns to load into each batch, in batch column order
+ * @param morsel             which morsel
+ * @param blocks_per_morsel  blocks in each morsel
+ * @return                   the batch scan (freed by caller)
+ */
+BatchScan *HeapTable::batches(const ColumnNames *column_names, uint morsel, uint blocks_per_morsel) {
+    open();
+    check_columns(column_names);
+    BlockID first = morsel * blocks_per_morsel + 1;
+    BlockID last = min(first + blocks_per_morsel - 1, this->file.get_last_block_id());
+    return new HeapTableBatches(*this, column_names, first, last);
+}
+
+/**
+ * Make sure all the given columns are in this table.
+ * @param column_names  columns to check
+ * @throws DbRelationError if one of them is not in this table
+ */
+void HeapTable::check_columns(const ColumnNames *column_names) const {
+    for (auto const &column_name : *column_names)
+        if (find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+}
+
+/**
+ * Make sure every column named in the where clause is one of ours.
+ * @param where   equality conditions to check (may be nullptr)
+ * @param ranges  range conditions to check (may be nullptr)
+ * @throws        DbRelationError if a column is unknown
+ */
+void HeapTable::check_columns(const ValueDict *where, const ValueRanges *ranges) const {
+    ColumnNames predicate_columns;
+    if (where != nullptr)
+        for (auto const &column : *where)
+            predicate_columns.push_back(column.first);
+    if (ranges != nullptr)
+        for (auto const &column : *ranges)
+            predicate_columns.push_back(column.first);
+    for (auto const &column_name : predicate_columns)
+        if (find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+}
+
 /**
  * See if the row at the given handle satisfies the given where clause
  * @param handle  row to check
- * @param where   conditions to check
+ * @param where   equality conditions to check
+ * @param ranges  range conditions to check
  * @return        true if conditions met, false otherwise
  */
-bool HeapTable::selected(Handle handle, const ValueDict *where) {
-    if (where == nullptr)
+bool HeapTable::selected(Handle handle, const ValueDict *where, const ValueRanges *ranges) {
+    if (where == nullptr && ranges == nullptr)
         return true;
-    ValueDict *row = this->project(handle, where);
-    bool is_selected = *row == *where;
-    delete row;
+    check_columns(where, ranges);
+    SlottedPage *block = file.get(handle.first);
+    bool is_selected = selected(block, handle.second, where, ranges);
+    delete block;
     return is_selected;
 }
 
+/**
+ * See if a record in an already-fetched block satisfies the given where clause.
+ * @param block      block holding the record
+ * @param record_id  record within block to check
+ * @param where      equality conditions to check
+ * @param ranges     range conditions to check
+ * @return           true if conditions met, false otherwise
+ */
+bool HeapTable::selected(SlottedPage *block, RecordID record_id, const ValueDict *where,
+                         const ValueRanges *ranges) const {
+    if (where == nullptr && ranges == nullptr)
+        return true;
+    u16 size;
+    const char *bytes = block->get_bytes(record_id, size);
+    return bytes != nullptr && selected(bytes, size, block->get_format(), where, ranges);
+}
+
+/**
+ * See if the marshaled record satisfies the given where clause.
+ * Only the predicate columns are decoded. In a ROW_V2 record each is gotten
+ * to directly; in a ROW_V1 record everything else is just skipped over, and we
+ * stop as soon as one predicate fails (or all of them have matched).
+ * @param bytes   marshaled record (as from SlottedPage::get_bytes)
+ * @param size    its size
+ * @param format  the format of the record's block
+ * @param where   conditions to check (equality on each named column)
+ * @param ranges  conditions to check (bounds on each named column)
+ * @return        true if conditions met, false otherwise
+ */
+bool HeapTable::selected(const char *bytes, u16 record_size, uint16_t format, const ValueDict *where,
+                         const ValueRanges *ranges) const {
+    u_long remaining = (where == nullptr ? 0 : where->size()) + (ranges == nullptr ? 0 : ranges->size());
+    if (remaining == 0)
+        return true;
+    if (format == ROW_V2) {
+        if (where != nullptr) {
+            for (auto const &predicate : *where) {
+                uint col_num = (uint) (find(this->column_names.begin(), this->column_names.end(), predicate.first) -
+                                       this->column_names.begin());
+                ColumnAttribute ca = this->column_attributes[col_num];
+                const Value &equal = predicate.second;
+                u16 size;
+                const char *value = field(bytes, record_size, col_num, size);
+                if (value == nullptr || equal.data_type != ca.get_data_type())
+                    return false;
+                if (equal.data_type == ColumnAttribute::DataType::TEXT) {
+                    if (size != equal.s.length() || memcmp(value, equal.s.data(), size) != 0)
+                        return false;
+                } else if (equal.data_type == ColumnAttribute::DataType::INT) {
+                    if (*(const int32_t *)value != equal.n)
+                        return false;
+                } else if (*(const uint8_t *)value != equal.n) {
+                    return false;
+                }
+            }
+        }
+        if (ranges != nullptr) {
+            for (auto const &predicate : *ranges) {
+                uint col_num = (uint) (find(this->column_names.begin(), this->column_names.end(), predicate.first) -
+                                       this->column_names.begin());
+                ColumnAttribute ca = this->column_attributes[col_num];
+                u16 size;
+                const char *value = field(bytes, record_size, col_num, size);
+                if (value == nullptr)
+                    return false;
+                if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+                    if (!predicate.second.contains_text(value, size))
+                        return false;
+                } else if (!predicate.second.contains(unmarshal(bytes, record_size, col_num))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    uint offset = 0;
+    uint col_num = 0;
+    Value value;
+    for (auto const &column_name : this->column_names) {
+        ColumnAttribute ca = this->column_attributes[col_num++];
+        ColumnAttribute::DataType data_type = ca.get_data_type();
+        const Value *equal = nullptr;
+        const ValueRange *range = nullptr;
+        if (where != nullptr) {
+            ValueDict::const_iterator predicate = where->find(column_name);
+            if (predicate != where->end()) {
+                equal = &predicate->second;
+                if (equal->data_type != data_type)
+                    return false;
+                remaining--;
+            }
+        }
+        if (ranges != nullptr) {
+            ValueRanges::const_iterator predicate = ranges->find(column_name);
+            if (predicate != ranges->end()) {
+                range = &predicate->second;
+                remaining--;
+            }
+        }
+        value.data_type = data_type;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            value.n = *(int32_t *)(bytes + offset);
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *)(bytes + offset);
+            offset += sizeof(u16);
+            if (equal != nullptr && (size != equal->s.length() || memcmp(bytes + offset, equal->s.data(), size) != 0))
+                return false;
+            if (range != nullptr && !range->contains_text(bytes + offset, size))
+                return false;
+            offset += size;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            value.n = *(uint8_t *)(bytes + offset);
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+        }
+        if (data_type != ColumnAttribute::DataType::TEXT && equal != nullptr && value.n != equal->n)
+            return false;
+        if (data_type != ColumnAttribute::DataType::TEXT && range != nullptr && !range->contains(value))
+            return false;
+        if (remaining == 0)
+            return true;
+    }
+    return remaining == 0;
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -363,6 +1013,111 @@ bool test_compare(DbRelation &table, Handle handle, int a, string b) {
 
 }
 
+/**
+ * Testing function for reading ROW_V1 blocks alongside ROW_V2 ones.
+ * @return true if the tests all succeeded
+ */
+bool test_row_formats() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    HeapTable table("_test_row_formats", column_names, column_attributes);
+    table.create();
+
+    // a record put into the first block the way it was before there were formats
+    string old_b = "old row";
+    char v1[sizeof(int32_t) + sizeof(u16) + 7 + sizeof(uint8_t)];
+    *(int32_t *) v1 = 12;
+    *(u16 *) (v1 + sizeof(int32_t)) = (u16) old_b.size();
+    memcpy(v1 + sizeof(int32_t) + sizeof(u16), old_b.data(), old_b.size());
+    v1[sizeof(v1) - 1] = 1;
+    Dbt v1_dbt(v1, sizeof(v1));
+    SlottedPage *block = table.file.get(1);
+    bool ok = block->get_format() == HeapTable::ROW_V1 || assertion_failure("new block format", block->get_format());
+    Handle old_handle(1, block->add(&v1_dbt));
+    table.file.put(block);
+    delete block;
+
+    // new rows don't go into it
+    ValueDict row;
+    test_set_row(row, 34, "new row");
+    Handle new_handle = table.insert(&row);
+    ok = ok && (new_handle.first == 2 || assertion_failure("added to a ROW_V1 block", new_handle.first));
+    block = table.file.get(new_handle.first);
+    ok = ok && (block->get_format() == HeapTable::ROW_V2 || assertion_failure("added block format"));
+    delete block;
+
+    // both read whole, by their last column alone, by predicates, and in batches
+    ok = ok && (test_compare(table, old_handle, 12, old_b) || assertion_failure("ROW_V1 project"));
+    ok = ok && (test_compare(table, new_handle, 34, "new row") || assertion_failure("ROW_V2 project"));
+    Handles both;
+    both.push_back(old_handle);
+    both.push_back(new_handle);
+    ColumnNames just_c(1, "c");
+    Rows *rows = table.project_rows(&both, &just_c);
+    ok = ok && (((*rows)[0]->size() == 1 && (*rows)[0]->at(0).n == 1 && (*rows)[1]->at(0).n == 1) ||
+                assertion_failure("project of the last column"));
+    for (auto r : *rows)
+        delete r;
+    delete rows;
+    for (auto const &handle : both) {
+        ValueDict *values = table.project(handle);
+        ValueDict where;
+        where["b"] = (*values)["b"];
+        ValueRanges ranges;
+        ranges["a"].restrict_min((*values)["a"], true);
+        ranges["a"].restrict_max((*values)["a"], true);
+        delete values;
+        Handles *found = table.select(&where, &ranges);
+        ok = ok && ((found->size() == 1 && (*found)[0] == handle) || assertion_failure("select", found->size()));
+        delete found;
+
+        // TEXT ranges are compared where the value is in the block
+        ValueRanges text_ranges;
+        text_ranges["b"].restrict_min(where["b"], true);
+        text_ranges["b"].restrict_max(where["b"], true);
+        found = table.select(nullptr, &text_ranges);
+        ok = ok && ((found->size() == 1 && (*found)[0] == handle) || assertion_failure("text range", found->size()));
+        delete found;
+        text_ranges["b"] = ValueRange();
+        text_ranges["b"].restrict_min(Value(where["b"].s.substr(0, 3)), false);
+        text_ranges["b"].restrict_max(where["b"], false);
+        found = table.select(nullptr, &text_ranges);
+        ok = ok && (found->empty() || assertion_failure("exclusive text range", found->size()));
+        delete found;
+    }
+    // refining a selection spanning both blocks keeps the given order
+    Handles reversed;
+    reversed.push_back(new_handle);
+    reversed.push_back(old_handle);
+    ValueRanges positive;
+    positive["a"].restrict_min(Value(0), true);
+    Handles *refined = table.select(&reversed, nullptr, &positive);
+    ok = ok && (*refined == reversed || assertion_failure("refined selection", refined->size()));
+    delete refined;
+    ValueDict only_new;
+    only_new["b"] = Value("new row");
+    refined = table.select(&reversed, &only_new, &positive);
+    ok = ok && ((refined->size() == 1 && (*refined)[0] == new_handle) || assertion_failure("refined by b"));
+    delete refined;
+
+    BatchScan *batches = table.batches(&column_names);
+    ColumnBatch batch(column_attributes);
+    ok = ok && ((batches->next(batch) && batch.size == 2 && batch.columns[0]->ints[0] == 12 &&
+                 batch.columns[1]->get_value(0).s == old_b && batch.columns[0]->ints[1] == 34 &&
+                 batch.columns[1]->get_value(1).s == "new row" && batch.columns[2]->ints[1] == 1) ||
+                assertion_failure("batches across formats", batch.size));
+    delete batches;
+
+    table.drop();
+    return ok;
+}
+
 /**
  * Testing function for heap storage engine.
  * @return true if the tests all succeeded
@@ -371,6 +1126,21 @@ bool test_heap_storage() {
     if (!test_slotted_page())
         return assertion_failure("slotted page tests failed");
     cout << endl << "slotted page tests ok" << endl;
+    if (!test_buffer_pool())
+        return assertion_failure("buffer pool tests failed");
+    cout << "buffer pool tests ok" << endl;
+    if (!test_query_arena())
+        return assertion_failure("query arena tests failed");
+    cout << "query arena tests ok" << endl;
+    if (!test_int_filter())
+        return assertion_failure("int filter tests failed");
+    cout << "int filter tests ok" << endl;
+    if (!test_parallel_scan())
+        return assertion_failure("parallel scan tests failed");
+    cout << "parallel scan tests ok" << endl;
+    if (!test_row_formats())
+        return assertion_failure("row format tests failed");
+    cout << "row format tests ok" << endl;
 
     ColumnNames column_names;
     column_names.push_back("a");
@@ -421,6 +1191,57 @@ bool test_heap_storage() {
     cout << "many inserts/select/projects ok" << endl;
     delete handles;
 
+    ValueDict where;
+    where["a"] = Value(500);
+    where["b"] = Value(b);
+    handles = table.select(&where);
+    if (handles->size() != 1 || !test_compare(table, (*handles)[0], 500, b))
+        return false;
+    delete handles;
+    where["b"] = Value("nope");
+    handles = table.select(&where);
+    if (handles->size() != 0)
+        return false;
+    delete handles;
+    cout << "select with where ok" << endl;
+
+    handles = table.select();
+    Handles reversed(handles->rbegin(), handles->rend());
+    ValueDicts *rows = table.project(&reversed);
+    bool projected = rows->size() == reversed.size();
+    for (u_long j = 0; projected && j < rows->size(); j++)
+        projected = (*rows)[j]->at("a").n == 999 - (int) j && (*rows)[j]->at("b").s == b;
+    for (auto row : *rows)
+        delete row;
+    delete rows;
+    delete handles;
+    if (!projected)
+        return false;
+    cout << "batch project ok" << endl;
+
+    ColumnNames just_a;
+    just_a.push_back("a");
+    where.clear();
+    where["b"] = Value(b);
+    ValueRanges ranges;
+    ranges["a"].restrict_min(Value(10), true);
+    ranges["a"].restrict_max(Value(20), false);
+    RowIterator *row_iterator = table.rows(&just_a, &where, &ranges);
+    Row *streamed;
+    int expected = 10;
+    while (row_iterator->next(streamed)) {
+        bool ok = streamed->size() == 1 && (*streamed)[0].n == expected++;
+        delete streamed;
+        if (!ok) {
+            delete row_iterator;
+            return false;
+        }
+    }
+    delete row_iterator;
+    if (expected != 20)
+        return false;
+    cout << "streamed rows ok" << endl;
+
     table.del(last_handle);
     handles = table.select();
     if (handles->size() != 1000)
@@ -0,0 +1,307 @@
+/**
+ * @file parallel_scan.cpp - implementation of ParallelScan
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include "parallel_scan.h"
+#include "heap_table.h"
+
+using namespace std;
+
+ParallelScan *ParallelScan::create(DbRelation &table, const ColumnNames *projection, const ValueDict *where,
+                                   const ValueRanges *ranges, uint workers, bool ordered) {
+    if (workers < 2)
+        return nullptr;
+    BatchExecutor *prototype = BatchExecutor::create(table, projection, where, ranges);
+    if (prototype == nullptr)
+        return nullptr;
+    uint morsels = table.morsel_count(BLOCKS_PER_MORSEL);
+    if (morsels < 2) {
+        delete prototype;
+        return nullptr;
+    }
+    workers = min(workers, min(morsels, ThreadPool::instance().get_thread_count() + 1));
+    return new ParallelScan(prototype, morsels, workers, ordered);
+}
+
+ParallelScan::ParallelScan(BatchExecutor *prototype, uint morsels, uint workers, bool ordered)
+        : prototype(prototype), local(nullptr), workers(workers), ordered(ordered), morsels(morsels), lock(),
+          changed(), started(0), consumed(0), results(), finished(), running(0), stopping(false), error(),
+          current(nullptr), i(0) {
+}
+
+ParallelScan::~ParallelScan() {
+    close();
+    delete this->prototype;
+}
+
+// Start the workers; the thread calling next() is one of them too.
+void ParallelScan::open() {
+    close();
+    this->started = this->consumed = 0;
+    this->results.assign(this->morsels, nullptr);
+    this->stopping = false;
+    this->error.clear();
+    this->local = new BatchExecutor(*this->prototype);
+    this->running = this->workers - 1;
+    for (uint w = 1; w < this->workers; w++)
+        ThreadPool::instance().submit([this] { this->work(); });
+}
+
+// Hand out the rows of each morsel in turn, scanning the morsel here if no worker has started it yet.
+bool ParallelScan::next(Row *&row) {
+    while (true) {
+        if (this->current != nullptr && this->i < this->current->size()) {
+            row = (*this->current)[this->i++];
+            return true;
+        }
+        delete this->current;  // its rows all belong to the caller now
+        this->current = nullptr;
+
+        uint morsel = 0;
+        bool here = false;
+        {
+            unique_lock<mutex> guard(this->lock);
+            if (!this->error.empty())
+                throw DbRelationError(this->error);
+            if (this->consumed >= this->morsels)
+                return false;
+            if (this->ordered) {
+                morsel = this->consumed;
+                here = morsel == this->started;
+            } else {
+                here = this->finished.empty() && this->started < this->morsels;
+                morsel = this->started;
+            }
+            if (here) {
+                this->started++;
+            } else {
+                this->changed.wait(guard, [this, morsel] {
+                    return !this->error.empty() ||
+                           (this->ordered ? this->results[morsel] != nullptr : !this->finished.empty());
+                });
+                if (!this->error.empty())
+                    throw DbRelationError(this->error);
+                if (!this->ordered) {
+                    morsel = this->finished.front();
+                    this->finished.erase(this->finished.begin());
+                }
+                this->current = this->results[morsel];
+                this->results[morsel] = nullptr;
+            }
+            this->consumed++;
+        }
+        this->changed.notify_all();  // room for the workers to start another morsel
+        if (here)
+            this->current = scan_morsel(*this->local, morsel);
+        this->i = 0;
+    }
+}
+
+// Stop the workers (they finish the morsel they are on) and free whatever rows weren't consumed.
+void ParallelScan::close() {
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+        this->changed.notify_all();
+        this->changed.wait(guard, [this] { return this->running == 0; });
+    }
+    for (auto rows: this->results)
+        free_rows(rows);
+    this->results.clear();
+    this->finished.clear();
+    free_rows(this->current, this->i);
+    this->current = nullptr;
+    delete this->local;
+    this->local = nullptr;
+}
+
+// A worker's loop: scan morsels until there are none left or we're told to stop.
+void ParallelScan::work() {
+    {
+        BatchExecutor executor(*this->prototype);
+        uint morsel;
+        while (take(morsel))
+            finish(morsel, scan_morsel(executor, morsel));
+    }
+    // notify under the lock: once running is 0, close() may return and this scan may be deleted
+    lock_guard<mutex> guard(this->lock);
+    this->running--;
+    this->changed.notify_all();
+}
+
+// Claim the next morsel for a worker, waiting while it is too far ahead of the consumer.
+bool ParallelScan::take(uint &morsel) {
+    unique_lock<mutex> guard(this->lock);
+    uint window = 2 * this->workers;
+    this->changed.wait(guard, [this, window] {
+        return this->stopping || this->started >= this->morsels || this->started < this->consumed + window;
+    });
+    if (this->stopping || this->started >= this->morsels)
+        return false;
+    morsel = this->started++;
+    return true;
+}
+
+// Post a worker's rows for a morsel.
+void ParallelScan::finish(uint morsel, Rows *rows) {
+    {
+        lock_guard<mutex> guard(this->lock);
+        this->results[morsel] = rows;
+        if (!this->ordered)
+            this->finished.push_back(morsel);
+    }
+    this->changed.notify_all();
+}
+
+// Run a morsel through an executor. An error is recorded (and stops the scan) rather than thrown, since this
+// may be running on a worker.
+Rows *ParallelScan::scan_morsel(BatchExecutor &executor, uint morsel) {
+    Rows *rows = new Rows();
+    try {
+        executor.set_morsel(morsel, BLOCKS_PER_MORSEL);
+        executor.open();
+        Row *row;
+        while (executor.next(row))
+            rows->push_back(row);
+        executor.close();
+    } catch (exception &e) {
+        executor.close();
+        lock_guard<mutex> guard(this->lock);
+        if (this->error.empty())
+            this->error = e.what();
+        this->stopping = true;
+    }
+    return rows;
+}
+
+void ParallelScan::free_rows(Rows *rows, u_long from) {
+    if (rows == nullptr)
+        return;
+    for (u_long j = from; j < rows->size(); j++)
+        delete (*rows)[j];
+    delete rows;
+}
+
+void benchmark_parallel_scan(ostream &out, uint rows) {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("k");
+    column_names.push_back("data");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_bench_parallel_scan", column_names, column_attributes);
+    table.create();
+    for (uint n = 0; n < rows; n++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) n);
+        row["k"] = Value((int32_t) (n % 100));
+        row["data"] = Value("row number " + to_string(n));
+        table.insert(&row);
+    }
+
+    ColumnNames projection(1, "id");
+    ValueDict where;
+    where["k"] = Value(7);
+    uint max_threads = ThreadPool::instance().get_thread_count();
+    out << "parallel scan of " << rows << " rows (" << table.morsel_count(ParallelScan::BLOCKS_PER_MORSEL)
+        << " morsels), selecting 1%" << endl;
+    for (uint threads = 1; ; threads = min(2 * threads, max_threads)) {
+        RowOperator *scan = ParallelScan::create(table, &projection, &where, nullptr, threads);
+        if (scan == nullptr)
+            scan = BatchExecutor::create(table, &projection, &where, nullptr);
+        auto start = chrono::steady_clock::now();
+        u_long selected = 0;
+        scan->open();
+        Row *row;
+        while (scan->next(row)) {
+            selected++;
+            delete row;
+        }
+        scan->close();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        delete scan;
+        out << "  " << threads << " thread(s): " << (uint64_t) (elapsed.count() * 1000) << " ms, "
+            << (uint64_t) (rows / elapsed.count() / 1e6) << "M rows/sec (" << selected << " selected)" << endl;
+        if (threads == max_threads)
+            break;
+    }
+    table.drop();
+}
+
+// Drain a row operator into a list of each row's id.
+static vector<int32_t> scanned_ids(RowOperator *rows) {
+    vector<int32_t> ids;
+    rows->open();
+    Row *row;
+    while (rows->next(row)) {
+        ids.push_back((*row)[0].n);
+        delete row;
+    }
+    rows->close();
+    return ids;
+}
+
+/**
+ * Testing function for parallel scans.
+ * @return true if the tests all succeeded
+ */
+bool test_parallel_scan() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("data");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("_test_parallel_scan", column_names, column_attributes);
+    table.create();
+    for (int32_t n = 0; n < 20000; n++) {
+        ValueDict row;
+        row["id"] = Value(n);
+        row["data"] = Value(string((size_t) n % 50, 'x'));
+        table.insert(&row);
+    }
+    if (table.morsel_count(ParallelScan::BLOCKS_PER_MORSEL) < 4)
+        return assertion_failure("test table too small to split", table.morsel_count(ParallelScan::BLOCKS_PER_MORSEL));
+
+    ColumnNames projection(1, "id");
+    ValueRanges ranges;
+    ranges["id"].restrict_min(Value(100), true);
+    RowOperator *serial = BatchExecutor::create(table, &projection, nullptr, &ranges);
+    vector<int32_t> expected = scanned_ids(serial);
+    delete serial;
+
+    uint threads = ThreadPool::instance().get_thread_count();
+    ThreadPool::instance().set_thread_count(4);  // even on one core, so the workers really run
+    bool ok = true;
+    for (int ordered = 1; ordered >= 0 && ok; ordered--) {
+        ParallelScan *parallel = ParallelScan::create(table, &projection, nullptr, &ranges, 4, ordered == 1);
+        if (parallel == nullptr) {
+            ok = assertion_failure("no parallel scan");
+            break;
+        }
+        vector<int32_t> ids = scanned_ids(parallel);
+        vector<int32_t> again = scanned_ids(parallel);  // reopening starts over
+        if (!ordered) {
+            sort(ids.begin(), ids.end());
+            sort(again.begin(), again.end());
+        }
+        if (ids != expected || again != expected)
+            ok = assertion_failure("parallel scan differs", ordered, (double) ids.size());
+
+        // stopping early leaves nothing running or pinned
+        parallel->open();
+        Row *row;
+        for (int n = 0; n < 3 && parallel->next(row); n++)
+            delete row;
+        parallel->close();
+        delete parallel;
+    }
+    ThreadPool::instance().set_thread_count(threads);
+    table.drop();
+    return ok;
+}
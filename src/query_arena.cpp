@@ -0,0 +1,131 @@
+/**
+ * @file query_arena.cpp - implementation of QueryArena
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include "query_arena.h"
+#include <cstring>
+#include "slotted_page.h"
+
+using namespace std;
+
+QueryArena::QueryArena() : chunks(), next(nullptr), end(nullptr), allocations(0), bytes(0), reused(0),
+                           heap_allocations(0), heap_bytes(0) {
+    memset(this->free_lists, 0, sizeof(this->free_lists));
+}
+
+QueryArena::~QueryArena() {
+    for (auto chunk : this->chunks)
+        delete[] chunk;
+}
+
+/**
+ * Get a block of at least size bytes, aligned for any type.
+ * @param size  bytes wanted
+ * @return      the block, good until it is freed or the arena is deleted
+ */
+void *QueryArena::allocate(size_t size) {
+    if (size == 0)
+        size = 1;
+    this->allocations++;
+    if (size > MAX_POOLED) {
+        this->bytes += size;
+        this->heap_allocations++;
+        this->heap_bytes += size;
+        return ::operator new(size);
+    }
+    size_t sc = size_class(size);
+    size = (sc + 1) * ALIGNMENT;
+    this->bytes += size;
+    void *block = this->free_lists[sc];
+    if (block != nullptr) {
+        this->free_lists[sc] = *(void **) block;
+        this->reused++;
+        return block;
+    }
+    if ((size_t) (this->end - this->next) < size) {
+        this->next = new char[CHUNK_SZ];  // new[] of char is aligned for any type
+        this->end = this->next + CHUNK_SZ;
+        this->chunks.push_back(this->next);
+        this->heap_allocations++;
+        this->heap_bytes += CHUNK_SZ;
+    }
+    block = this->next;
+    this->next += size;
+    return block;
+}
+
+/**
+ * Give back a block to be handed out again. Its memory stays in the arena.
+ * @param block  from allocate(size)
+ * @param size   the size it was allocated with
+ */
+void QueryArena::free(void *block, size_t size) {
+    if (block == nullptr)
+        return;
+    if (size > MAX_POOLED) {
+        ::operator delete(block);
+        return;
+    }
+    size_t sc = size_class(size == 0 ? 1 : size);
+    *(void **) block = this->free_lists[sc];
+    this->free_lists[sc] = block;
+}
+
+std::ostream &operator<<(std::ostream &out, const QueryArena &arena) {
+    out << "query memory: " << arena.get_allocations() << " allocations (" << arena.get_reused() << " reused) of "
+        << arena.get_bytes() << " bytes, from " << arena.get_heap_allocations() << " heap allocations of "
+        << arena.get_heap_bytes() << " bytes";
+    return out;
+}
+
+/**
+ * Testing function for QueryArena.
+ * @return true if the tests all succeeded
+ */
+bool test_query_arena() {
+    QueryArena arena;
+
+    // blocks are aligned, distinct, and carved out of one chunk
+    char *a = (char *) arena.allocate(1);
+    char *b = (char *) arena.allocate(100);
+    char *c = (char *) arena.allocate(QueryArena::ALIGNMENT);
+    bool ok = ((size_t) a % QueryArena::ALIGNMENT == 0 && (size_t) b % QueryArena::ALIGNMENT == 0 &&
+               (size_t) c % QueryArena::ALIGNMENT == 0) || assertion_failure("alignment");
+    ok = ok && ((b >= a + 1 && c >= b + 100) || assertion_failure("overlap"));
+    memset(b, 'x', 100);
+    ok = ok && ((arena.get_allocations() == 3 && arena.get_heap_allocations() == 1) ||
+                assertion_failure("chunks", arena.get_heap_allocations()));
+
+    // a block given back is reused for the next one its size
+    arena.free(b, 100);
+    char *d = (char *) arena.allocate(100);
+    ok = ok && ((d == b && arena.get_reused() == 1) || assertion_failure("reuse"));
+    char *e = (char *) arena.allocate(200);
+    ok = ok && (e != b || assertion_failure("reused for another size"));
+
+    // big blocks come from the heap and go right back
+    char *big = (char *) arena.allocate(QueryArena::MAX_POOLED + 1);
+    memset(big, 'y', QueryArena::MAX_POOLED + 1);
+    arena.free(big, QueryArena::MAX_POOLED + 1);
+    ok = ok && (arena.get_heap_allocations() == 2 || assertion_failure("big block", arena.get_heap_allocations()));
+
+    // rows streamed one at a time keep reusing the same memory
+    for (int32_t i = 0; i < 10000; i++) {
+        Row *row = new Row(ArenaAllocator<Value>(&arena));
+        for (int32_t n = 0; n < 5; n++)
+            row->push_back(Value(n + i));
+        ok = ok && ((*row)[4].n == 4 + i || assertion_failure("row value", i));
+        delete row;
+    }
+    ok = ok && (arena.get_heap_allocations() == 2 || assertion_failure("rows grew", arena.get_heap_allocations()));
+
+    // a copy of a row is on the heap, so it can outlive the arena
+    Row *row = new Row(ArenaAllocator<Value>(&arena));
+    row->push_back(Value("kept"));
+    Row copy(*row);
+    delete row;
+    ok = ok && ((copy.get_allocator().get_arena() == nullptr && copy[0].s == "kept") || assertion_failure("copy"));
+    return ok;
+}
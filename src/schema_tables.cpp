@@ -6,6 +6,7 @@
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "hash_index.h"
 
 
 void initialize_schema_tables() {
@@ -381,27 +382,6 @@ void Indices::get_columns(Identifier table_name, Identifier index_name,
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-  public:
-    DummyIndex(DbRelation &rel, Identifier idx, ColumnNames key, bool unq)
-        : DbIndex(rel, idx, key, unq) {}
-
-    void create() {}
-
-    void drop() {}
-
-    void open() {}
-
-    void close() {}
-
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
-
-    void insert(Handle handle) {}
-
-    void del(Handle handle) {}
-};
-
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just
@@ -410,17 +390,16 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
+    // otherwise make it from its rows in _indices
     ColumnNames column_names;
     bool is_hash, is_unique;
     get_columns(table_name, index_name, column_names, is_hash, is_unique);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names,
-                               is_unique); // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = BTreeIndex::make(table, index_name, column_names, is_unique);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
@@ -441,3 +420,73 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     delete handles;
     return ret;
 }
+
+bool Indices::has_duplicate(Identifier table_name, ValueDict *row) {
+    for (auto const &index_name : get_index_names(table_name)) {
+        ColumnNames key_columns;
+        bool is_hash = false, is_unique = false;
+        get_columns(table_name, index_name, key_columns, is_hash, is_unique);
+        if (!is_unique)
+            continue;
+        DbIndex &index = get_index(table_name, index_name);
+        index.open();  // get_index only constructs it; lookups don't open it themselves
+        if (index.contains(row))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Testing function for the unique-key check on insert, with the index as a later
+ * session finds it: on file, but not yet constructed.
+ * @return true if the tests all succeeded
+ */
+bool test_unique_probe() {
+    const Identifier table_name = "_test_unique_probe", index_name = "upx";
+    DbRelation &columns = Tables::get_table(Columns::TABLE_NAME);
+    ValueDict column_row;
+    column_row["table_name"] = Value(table_name);
+    column_row["column_name"] = Value("a");
+    column_row["data_type"] = Value("INT");
+    Handle column_handle = columns.insert(&column_row);
+    DbRelation &table = Tables::get_table(table_name);
+    table.create();
+    ValueDict row;
+    for (int32_t i = 0; i < 1000; i++) {
+        row["a"] = Value(i * 2);
+        table.insert(&row);
+    }
+    ColumnNames key_columns(1, "a");
+    DbIndex *built = BTreeIndex::make(table, index_name, key_columns, true);
+    built->create();
+    built->close();
+    delete built;
+
+    Indices indices;
+    indices.open();
+    ValueDict index_row;
+    index_row["table_name"] = Value(table_name);
+    index_row["index_name"] = Value(index_name);
+    index_row["column_name"] = Value("a");
+    index_row["seq_in_index"] = Value(1);
+    index_row["index_type"] = Value("BTREE");
+    index_row["is_unique"] = Value(true);
+    Handle index_handle = indices.insert(&index_row);
+
+    bool ok = true;
+    try {
+        row["a"] = Value(998);
+        ok = indices.has_duplicate(table_name, &row) || assertion_failure("duplicate key not found");
+        row["a"] = Value(999);
+        ok = ok && (!indices.has_duplicate(table_name, &row) || assertion_failure("missing key found"));
+    } catch (std::exception &e) {
+        ok = assertion_failure("unique probe threw: " + std::string(e.what()));
+    }
+
+    indices.get_index(table_name, index_name).drop();
+    indices.del(index_handle);
+    indices.close();
+    table.drop();
+    columns.del(column_handle);
+    return ok;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file simd_filter.cpp - implementation of the IntFilter kernels
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "simd_filter.h"
+#include "slotted_page.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INT_FILTER_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// A word kernel compares the 64 values starting at v against k and returns one bit per value.
+typedef uint64_t (*WordKernel)(const int32_t *v, int32_t k);
+
+template<IntFilter::Op OP>
+static inline bool compare(int32_t value, int32_t k) {
+    switch (OP) {
+        case IntFilter::EQ:
+            return value == k;
+        case IntFilter::LT:
+            return value < k;
+        case IntFilter::LE:
+            return value <= k;
+        case IntFilter::GT:
+            return value > k;
+        default:
+            return value >= k;
+    }
+}
+
+template<IntFilter::Op OP>
+static uint64_t word_scalar(const int32_t *v, int32_t k) {
+    uint64_t bits = 0;
+    for (uint i = 0; i < 64; i++)
+        bits |= (uint64_t) compare<OP>(v[i], k) << i;
+    return bits;
+}
+
+#ifdef INT_FILTER_X86
+// LE and GE are done as the complement of GT and LT, since there are only equal and greater-than compares.
+template<IntFilter::Op OP>
+__attribute__((target("sse4.2")))
+static uint64_t word_sse42(const int32_t *v, int32_t k) {
+    __m128i kv = _mm_set1_epi32(k);
+    uint64_t bits = 0;
+    for (uint i = 0; i < 64; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (v + i));
+        __m128i r = OP == IntFilter::EQ ? _mm_cmpeq_epi32(x, kv)
+                  : OP == IntFilter::GT || OP == IntFilter::LE ? _mm_cmpgt_epi32(x, kv) : _mm_cmpgt_epi32(kv, x);
+        bits |= (uint64_t) (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(r)) << i;
+    }
+    return OP == IntFilter::LE || OP == IntFilter::GE ? ~bits : bits;
+}
+
+template<IntFilter::Op OP>
+__attribute__((target("avx2")))
+static uint64_t word_avx2(const int32_t *v, int32_t k) {
+    __m256i kv = _mm256_set1_epi32(k);
+    uint64_t bits = 0;
+    for (uint i = 0; i < 64; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (v + i));
+        __m256i r = OP == IntFilter::EQ ? _mm256_cmpeq_epi32(x, kv)
+                  : OP == IntFilter::GT || OP == IntFilter::LE ? _mm256_cmpgt_epi32(x, kv) : _mm256_cmpgt_epi32(kv, x);
+        bits |= (uint64_t) (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(r)) << i;
+    }
+    return OP == IntFilter::LE || OP == IntFilter::GE ? ~bits : bits;
+}
+#endif
+
+#define WORD_KERNELS(name) \
+        {name<IntFilter::EQ>, name<IntFilter::LT>, name<IntFilter::LE>, name<IntFilter::GT>, name<IntFilter::GE>}
+
+static const WordKernel word_kernels[][5] = {
+        WORD_KERNELS(word_scalar),
+#ifdef INT_FILTER_X86
+        WORD_KERNELS(word_sse42),
+        WORD_KERNELS(word_avx2),
+#endif
+};
+
+const char *IntFilter::level_name(Level level) {
+    switch (level) {
+        case AVX2:
+            return "avx2";
+        case SSE42:
+            return "sse4.2";
+        default:
+            return "scalar";
+    }
+}
+
+static IntFilter::Level detect_level() {
+#ifdef INT_FILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return IntFilter::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return IntFilter::SSE42;
+#endif
+    return IntFilter::SCALAR;
+}
+
+IntFilter::Level IntFilter::best_level() {
+    static Level level = detect_level();
+    return level;
+}
+
+void IntFilter::set_all(uint64_t *mask, uint n) {
+    uint full = n / 64;
+    for (uint w = 0; w < full; w++)
+        mask[w] = ~(uint64_t) 0;
+    if (n % 64 != 0)
+        mask[full] = ((uint64_t) 1 << (n % 64)) - 1;
+}
+
+void IntFilter::filter(Level level, const int32_t *values, uint n, Op op, int32_t k, uint64_t *mask) {
+    WordKernel kernel = word_kernels[level][op];
+    uint full = n / 64;
+    for (uint w = 0; w < full; w++)
+        if (mask[w] != 0)  // nothing left to narrow
+            mask[w] &= kernel(values + 64 * w, k);
+
+    // the last partial word, through a zero-padded copy so the kernel doesn't read past the end
+    uint rest = n % 64;
+    if (rest != 0 && mask[full] != 0) {
+        int32_t tail[64] = {};
+        for (uint i = 0; i < rest; i++)
+            tail[i] = values[64 * full + i];
+        mask[full] &= kernel(tail, k) & (((uint64_t) 1 << rest) - 1);
+    }
+}
+
+uint IntFilter::to_selection(const uint64_t *mask, uint n, uint16_t *selection) {
+    uint selected = 0;
+    for (uint w = 0; w < mask_words(n); w++) {
+        uint64_t bits = mask[w];
+        while (bits != 0) {
+            selection[selected++] = (uint16_t) (64 * w + __builtin_ctzll(bits));
+            bits &= bits - 1;  // drop the lowest bit
+        }
+    }
+    return selected;
+}
+
+void IntFilter::benchmark(ostream &out, uint rows) {
+    static const char *op_names[] = {"=", "<", "<=", ">", ">="};
+    vector<int32_t> values(rows);
+    for (uint i = 0; i < rows; i++)
+        values[i] = rand() % 100;
+    vector<uint64_t> mask(mask_words(rows));
+    const uint passes = 20;
+
+    out << "int filter kernels, " << rows << " rows, best level " << level_name(best_level()) << endl;
+    for (int level = SCALAR; level <= best_level(); level++) {
+        for (int op = EQ; op <= GE; op++) {
+            auto start = chrono::steady_clock::now();
+            for (uint pass = 0; pass < passes; pass++) {
+                set_all(mask.data(), rows);
+                filter((Level) level, values.data(), rows, (Op) op, 50, mask.data());
+            }
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            uint selected = 0;
+            for (auto word: mask)
+                selected += (uint) __builtin_popcountll(word);
+            out << "  " << level_name((Level) level) << " x " << op_names[op] << " 50: "
+                << (uint64_t) (passes * (double) rows / elapsed.count() / 1e6) << "M rows/sec ("
+                << selected << " selected)" << endl;
+        }
+    }
+}
+
+/**
+ * Testing function for the int filter kernels.
+ * @return true if the tests all succeeded
+ */
+bool test_int_filter() {
+    const uint n = 1000;  // not a multiple of 64, so the tail is covered
+    int32_t values[n];
+    for (uint i = 0; i < n; i++)
+        values[i] = (int32_t) (rand() % 21) - 10;
+    uint64_t mask[(n + 63) / 64];
+    uint16_t selection[n];
+
+    for (int level = IntFilter::SCALAR; level <= IntFilter::best_level(); level++) {
+        for (int op = IntFilter::EQ; op <= IntFilter::GE; op++) {
+            // op against 3, and (for the conjunction) value != -10 via value > -10
+            IntFilter::set_all(mask, n);
+            IntFilter::filter((IntFilter::Level) level, values, n, (IntFilter::Op) op, 3, mask);
+            IntFilter::filter((IntFilter::Level) level, values, n, IntFilter::GT, -10, mask);
+            uint selected = IntFilter::to_selection(mask, n, selection);
+
+            uint expected = 0;
+            for (uint i = 0; i < n; i++) {
+                int32_t v = values[i];
+                bool keep = op == IntFilter::EQ ? v == 3 : op == IntFilter::LT ? v < 3 : op == IntFilter::LE ? v <= 3
+                          : op == IntFilter::GT ? v > 3 : v >= 3;
+                if (keep && v > -10) {
+                    if (expected >= selected || selection[expected] != i)
+                        return assertion_failure(string("wrong selection at ") + IntFilter::level_name(
+                                (IntFilter::Level) level), op, i);
+                    expected++;
+                }
+            }
+            if (expected != selected)
+                return assertion_failure("selected too many", selected, expected);
+        }
+    }
+    return true;
+}
@@ -9,21 +9,57 @@
 using namespace std;
 typedef uint16_t u16;
 
+static_assert(DbBlock::BLOCK_SZ <= 0x1000, "end of free space must leave the top 4 bits for the format");
+static const u16 FORMAT_SHIFT = 12;
+static const u16 END_FREE_MASK = (1U << FORMAT_SHIFT) - 1U;
+
 /**
  * SlottedPage constructor
  * @param block
  * @param block_id
  * @param is_new
+ * @param frame     buffer pool frame holding the block; the page takes over the caller's pin on it
  */
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new)
-    : DbBlock(block, block_id, is_new) {
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new, BufferFrame *frame)
+    : DbBlock(block, block_id, is_new), frame(frame) {
     if (is_new) {
         this->num_records = 0;
         this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->format = 0;
         put_header();
     } else {
-        get_header(this->num_records, this->end_free);
+        u16 end_free_and_format;
+        get_header(this->num_records, end_free_and_format);
+        this->end_free = end_free_and_format & END_FREE_MASK;
+        this->format = end_free_and_format >> FORMAT_SHIFT;
+    }
+}
+
+SlottedPage::~SlottedPage() {
+    if (this->frame != nullptr)
+        this->frame->unpin();
+}
+
+SlottedPage::SlottedPage(const SlottedPage &other)
+    : DbBlock(other), num_records(other.num_records), end_free(other.end_free), format(other.format),
+      frame(other.frame) {
+    if (this->frame != nullptr)
+        this->frame->pin();
+}
+
+SlottedPage &SlottedPage::operator=(const SlottedPage &other) {
+    if (this != &other) {
+        if (other.frame != nullptr)
+            other.frame->pin();
+        if (this->frame != nullptr)
+            this->frame->unpin();
+        DbBlock::operator=(other);
+        this->num_records = other.num_records;
+        this->end_free = other.end_free;
+        this->format = other.format;
+        this->frame = other.frame;
     }
+    return *this;
 }
 
 /**
@@ -96,6 +132,58 @@ void SlottedPage::del(RecordID record_id) {
     slide(loc, loc + size);
 }
 
+/**
+ * Add a new record at a given id, sliding the headers of record_id and those after it up one.
+ * @param record_id  1 to num_records + 1
+ * @param data       the new record
+ */
+void SlottedPage::insert(RecordID record_id, const Dbt *data) {
+    if (record_id < 1 || record_id > this->num_records + 1U)
+        throw DbRelationError("record id " + to_string(record_id) + " out of range for insert");
+    u16 size = (u16) data->get_size();
+    if (!has_room(size))
+        throw DbBlockNoRoomError("not enough room for new record");
+    memmove(this->address((u16) (4 * (record_id + 1))), this->address((u16) (4 * record_id)),
+            4 * (this->num_records - record_id + 1U));
+    this->num_records++;
+    this->end_free -= size;
+    u16 loc = this->end_free + 1U;
+    put_header();
+    put_header(record_id, size, loc);
+    memcpy(this->address(loc), data->get_data(), size);
+}
+
+/**
+ * Remove a record and its header, compacting the data and sliding the later headers down one.
+ * @param record_id  record to remove
+ */
+void SlottedPage::erase(RecordID record_id) {
+    if (record_id < 1 || record_id > this->num_records)
+        throw DbRelationError("record id " + to_string(record_id) + " out of range for erase");
+    u16 size, loc;
+    get_header(size, loc, record_id);
+    if (loc != 0)
+        slide(loc, loc + size);
+    memmove(this->address((u16) (4 * record_id)), this->address((u16) (4 * (record_id + 1))),
+            4 * (this->num_records - record_id));
+    this->num_records--;
+    put_header();
+}
+
+/**
+ * The bytes of a record as they sit in the block.
+ * @param record_id  which record
+ * @param size       set to the size of the record
+ * @return           pointer into the block, or nullptr if the record has been deleted
+ */
+const char *SlottedPage::get_bytes(RecordID record_id, u16 &size) const {
+    u16 loc;
+    get_header(size, loc, record_id);
+    if (loc == 0)
+        return nullptr;
+    return (const char *) this->address(loc);
+}
+
 /**
  * Sequence of all non-deleted record IDs.
  * @return  sequence of IDs (freed by caller)
@@ -111,6 +199,17 @@ RecordIDs *SlottedPage::ids(void) const {
     return vec;
 }
 
+/**
+ * Set the page's format (kept through clear()).
+ * @param format  0 to MAX_FORMAT
+ */
+void SlottedPage::set_format(u16 format) {
+    if (format > MAX_FORMAT)
+        throw DbRelationError("page format " + to_string(format) + " out of range");
+    this->format = format;
+    put_header();
+}
+
 /**
  * Erase all the records
  */
@@ -156,7 +255,7 @@ void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const
 void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
     if (id == 0) { // called the put_header() version and using the default params
         size = this->num_records;
-        loc = this->end_free;
+        loc = (u16) (this->end_free | (this->format << FORMAT_SHIFT));
     }
     put_n((u16) 4 * id, size);
     put_n((u16) (4 * id + 2), loc);
@@ -209,17 +308,15 @@ void SlottedPage::slide(u_int16_t start, u_int16_t end) {
     int bytes = start - (this->end_free + 1U);
     memmove(to, from, bytes);
 
-    // fix up headers to the right
-    RecordIDs *record_ids = ids();
-    for (auto const &record_id : *record_ids) {
+    // fix up headers to the right (skipping tombstones)
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         u16 size, loc;
         get_header(size, loc, record_id);
-        if (loc <= start) {
+        if (loc != 0 && loc <= start) {
             loc += shift;
             put_header(record_id, size, loc);
         }
     }
-    delete record_ids;
     this->end_free += shift;
     put_header();
 }
@@ -353,6 +450,32 @@ bool test_slotted_page() {
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
 
+    // insert and erase keep ids in order without leaving tombstones
+    char rec3[] = "in between";
+    Dbt rec3_dbt(rec3, sizeof(rec3));
+    slot.insert(2, &rec3_dbt);  // ids now: 1 (deleted), 2 (rec3), 3 (rec2)
+    u_int16_t size;
+    const char *bytes = slot.get_bytes(2, size);
+    if (bytes == nullptr || string(bytes, size) != string(rec3, sizeof(rec3)))
+        return assertion_failure("get_bytes after insert");
+    bytes = slot.get_bytes(3, size);
+    if (bytes == nullptr || string(bytes, size) != string(rec2, sizeof(rec2)))
+        return assertion_failure("record moved up by insert");
+    slot.erase(2);
+    bytes = slot.get_bytes(2, size);
+    if (slot.last_id() != 2 || bytes == nullptr || string(bytes, size) != string(rec2, sizeof(rec2)))
+        return assertion_failure("record moved down by erase");
+    if (slot.get_bytes(1, size) != nullptr)
+        return assertion_failure("get_bytes of deleted record was not null");
+
+    // the format is kept in the header without disturbing the free space
+    u_int16_t unused = slot.unused_bytes();
+    slot.set_format(SlottedPage::MAX_FORMAT);
+    SlottedPage reread(block_dbt, 1);
+    if (reread.get_format() != SlottedPage::MAX_FORMAT || reread.unused_bytes() != unused)
+        return assertion_failure("format in header", reread.get_format(), reread.unused_bytes());
+    slot.set_format(0);
+
     // try adding something too big
     rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
     try {
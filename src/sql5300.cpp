@@ -11,6 +11,10 @@
 #include <iostream>
 #include <string>
 #include "btree.h"
+#include "hash_index.h"
+#include "buffer_pool.h"
+#include "simd_filter.h"
+#include "parallel_scan.h"
 
 using namespace std;
 using namespace hsql;
@@ -40,11 +44,43 @@ int main(int argc, char *argv[]) {
         getline(cin, query);
         if (query.length() == 0)
             continue;  // blank line -- just skip
-        if (query == "quit")
+        if (query == "quit") {
+            BufferPool::instance().flush();
             break;  // only way to get out
+        }
+        if (query == "pool") {
+            cout << BufferPool::instance() << endl;
+            continue;
+        }
+        if (query == "bench") {
+            IntFilter::benchmark(cout);
+            benchmark_parallel_scan(cout);
+            continue;
+        }
+        if (query.compare(0, 11, "fillfactor ") == 0) {
+            int fill_factor = atoi(query.c_str() + 11);
+            if (fill_factor < 10 || fill_factor > 100) {
+                cout << "fill factor must be from 10 to 100" << endl;
+            } else {
+                SQLExec::index_fill_factor = (uint) fill_factor;
+                cout << "new indices fill " << fill_factor << "% of each block" << endl;
+            }
+            continue;
+        }
+        if (query.compare(0, 8, "threads ") == 0) {
+            ThreadPool::instance().set_thread_count((uint) atoi(query.c_str() + 8));
+            cout << ThreadPool::instance().get_thread_count() << " threads" << endl;
+            continue;
+        }
+        if (query == "memory") {
+            SQLExec::report_memory = !SQLExec::report_memory;
+            cout << "query memory reports " << (SQLExec::report_memory ? "on" : "off") << endl;
+            continue;
+        }
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
             continue;
         }
 
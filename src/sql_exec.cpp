@@ -7,6 +7,9 @@
 
 // #define DEBUG_ENABLED
 #include "debug.h"
+#include "btree.h"
+#include "thread_pool.h"
+#include <climits>
 
 using namespace std;
 using namespace hsql;
@@ -23,6 +26,30 @@ const Identifier DATA_TYPE = "data_type";
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+bool SQLExec::vectorized = true;
+uint SQLExec::index_fill_factor = BTreeStat::DEFAULT_FILL_FACTOR;
+bool SQLExec::report_memory = false;
+
+// Print the values of one row, in column order.
+static void print_row(ostream &out, const Row &row) {
+    for (auto const &value : row) {
+        switch (value.data_type) {
+        case ColumnAttribute::INT:
+            out << value.n;
+            break;
+        case ColumnAttribute::TEXT:
+            out << "\"" << value.s << "\"";
+            break;
+        case ColumnAttribute::BOOLEAN:
+            out << (value.n == 0 ? "false" : "true");
+            break;
+        default:
+            out << "???";
+        }
+        out << " ";
+    }
+    out << endl;
+}
 
 // make query result be printable
 ostream &operator<<(ostream &out, const QueryResult &qres) {
@@ -33,25 +60,30 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
         for (unsigned int i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << endl;
-        for (auto const &row : *qres.rows) {
-            for (auto const &column_name : *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                case ColumnAttribute::INT:
-                    out << value.n;
-                    break;
-                case ColumnAttribute::TEXT:
-                    out << "\"" << value.s << "\"";
-                    break;
-                case ColumnAttribute::BOOLEAN:
-                    out << (value.n == 0 ? "false" : "true");
-                    break;
-                default:
-                    out << "???";
+        if (qres.stream != nullptr) {
+            // print the rows as they come, without holding on to them
+            u_long n = 0;
+            Row *row;
+            try {
+                while (qres.stream->next(row)) {
+                    print_row(out, *row);
+                    delete row;
+                    n++;
                 }
-                out << " ";
+                qres.message = "successfully returned " + to_string(n) + " rows";
+            } catch (DbRelationError &e) {
+                qres.message = string("Error: DbRelationError: ") + e.what();
+            }
+            qres.end_stream();
+            if (SQLExec::report_memory && qres.arena != nullptr)
+                out << *qres.arena << endl;
+        } else if (qres.rows != nullptr) {
+            for (auto const &row : *qres.rows) {
+                Row values;
+                for (auto const &column_name : *qres.column_names)
+                    values.push_back(row->at(column_name));
+                print_row(out, values);
             }
-            out << endl;
         }
     }
     out << qres.message;
@@ -59,6 +91,7 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
 }
 
 QueryResult::~QueryResult() {
+    end_stream();
     if (column_names != nullptr)
         delete column_names;
     if (column_attributes != nullptr)
@@ -68,6 +101,39 @@ QueryResult::~QueryResult() {
             delete row;
         delete rows;
     }
+    delete arena;  // after the stream, whose operators may still hold rows
+}
+
+/**
+ * Pull any rows still to come from the stream into rows.
+ * @return the rows
+ */
+ValueDicts *QueryResult::get_rows() const {
+    if (stream != nullptr) {
+        rows = new ValueDicts();
+        Row *row;
+        while (stream->next(row)) {
+            rows->push_back(to_value_dict(*column_names, *row));
+            delete row;
+        }
+        message = "successfully returned " + to_string(rows->size()) + " rows";
+        end_stream();
+    }
+    return rows;
+}
+
+const std::string &QueryResult::get_message() const {
+    if (stream != nullptr)
+        get_rows();
+    return message;
+}
+
+void QueryResult::end_stream() const {
+    if (stream != nullptr) {
+        stream->close();
+        delete stream;
+        stream = nullptr;
+    }
 }
 
 QueryResult *SQLExec::execute(const SQLStatement *statement) {
@@ -78,22 +144,31 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     }
 
     try {
+        QueryResult *result;
         switch (statement->type()) {
         case kStmtCreate:
-            return create((const CreateStatement *)statement);
+            result = create((const CreateStatement *)statement);
+            break;
         case kStmtDrop:
-            return drop((const DropStatement *)statement);
+            result = drop((const DropStatement *)statement);
+            break;
         case kStmtShow:
-            return show((const ShowStatement *)statement);
+            result = show((const ShowStatement *)statement);
+            break;
         case kStmtInsert:
-            return insert((const InsertStatement *)statement);
+            result = insert((const InsertStatement *)statement);
+            break;
         case kStmtDelete:
-            return del((const DeleteStatement *)statement);
+            result = del((const DeleteStatement *)statement);
+            break;
         case kStmtSelect:
-            return select((const SelectStatement *)statement);
+            result = select((const SelectStatement *)statement);
+            break;
         default:
             return new QueryResult("not implemented");
         }
+        BufferPool::instance().flush();  // write back whatever the statement changed
+        return result;
     } catch (DbRelationError &e) {
         throw SQLExecError(string("DbRelationError: ") + e.what());
     }
@@ -139,18 +214,26 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
         }
     }
 
+    // a duplicate in any unique index turns the row away before it gets to the table
+    if (indices->has_duplicate(table_name, &row))
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    auto index_names = indices->get_index_names(table_name);
+
     auto handle = table.insert(&row);
 
-    auto index_names = indices->get_index_names(table_name);
+    // the indices take their keys from row rather than reading the new record back
+    uint indexed = 0;
     try {
         for (Identifier &index_name : index_names) {
             DbIndex &index = indices->get_index(table_name, index_name);
-            index.insert(handle);
+            index.insert(handle, &row);
+            indexed++;
         }
     } catch (exception &e) {
-        for (Identifier &index_name : index_names) {
-            DbIndex &index = indices->get_index(table_name, index_name);
-            // index.del(handle); // TODO: implement del in BTreeIndex
+        // back out of the indices that took it, then the table itself
+        for (uint i = 0; i < indexed; i++) {
+            DbIndex &index = indices->get_index(table_name, index_names[i]);
+            index.del(handle, &row);
         }
         table.del(handle);
         throw;
@@ -164,23 +247,54 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
     return new QueryResult(message);
 }
 
-void parse_expr(Expr *expr, ValueDict &where) {
+Value parse_literal(Expr *expr) {
+    if (expr->type == kExprLiteralInt)
+        return Value(expr->ival);
+    if (expr->type == kExprLiteralString)
+        return Value(expr->name);
+    throw SQLExecError("Not supported literal type");
+}
+
+// Pull the predicates out of a WHERE clause: equalities go into where, <, <=, >, >=, and BETWEEN into ranges.
+void parse_expr(Expr *expr, ValueDict &where, ValueRanges &ranges) {
     switch (expr->opType) {
     case Expr::AND:
-        parse_expr(expr->expr, where);
-        parse_expr(expr->expr2, where);
+        parse_expr(expr->expr, where, ranges);
+        parse_expr(expr->expr2, where, ranges);
         break;
-    case Expr::SIMPLE_OP: {
+    case Expr::SIMPLE_OP:
+    case Expr::LESS_EQ:
+    case Expr::GREATER_EQ: {
         Expr *col_expr = expr->expr;
         Expr *val_expr = expr->expr2;
-        string column_name = col_expr->name;
-        if (val_expr->type == kExprLiteralInt) {
-            where[column_name] = Value(val_expr->ival);
-        } else if (val_expr->type == kExprLiteralString) {
-            where[column_name] = Value(val_expr->name);
-        } else {
-            throw SQLExecError("Not supported literal type");
+        char op = expr->opType == Expr::SIMPLE_OP ? expr->opChar : 0;
+        bool inclusive = expr->opType != Expr::SIMPLE_OP;
+        bool less = op == '<' || expr->opType == Expr::LESS_EQ;
+        if (col_expr->type != kExprColumnRef && val_expr->type == kExprColumnRef) {
+            // literal on the left, e.g., 3 < x, so flip it around to x > 3
+            swap(col_expr, val_expr);
+            less = !less;
         }
+        if (col_expr->type != kExprColumnRef)
+            throw SQLExecError("Only know how to compare a column to a literal");
+        string column_name = col_expr->name;
+        Value value = parse_literal(val_expr);
+        if (op == '=')
+            where[column_name] = value;
+        else if (op != 0 && op != '<' && op != '>')
+            throw SQLExecError(string("Not supported comparison operator ") + op);
+        else if (less)
+            ranges[column_name].restrict_max(value, inclusive);
+        else
+            ranges[column_name].restrict_min(value, inclusive);
+        break;
+    }
+    case Expr::BETWEEN: {
+        if (expr->expr->type != kExprColumnRef || expr->exprList == nullptr || expr->exprList->size() != 2)
+            throw SQLExecError("Only know how to do BETWEEN on a column with two literals");
+        string column_name = expr->expr->name;
+        ranges[column_name].restrict_min(parse_literal(expr->exprList->at(0)), true);
+        ranges[column_name].restrict_max(parse_literal(expr->exprList->at(1)), true);
         break;
     }
     default:
@@ -191,54 +305,42 @@ void parse_expr(Expr *expr, ValueDict &where) {
 QueryResult *SQLExec::del(const DeleteStatement *statement) {
 
     ValueDict where;
+    ValueRanges ranges;
     if (statement->expr != nullptr)
-        parse_expr(statement->expr, where);
+        parse_expr(statement->expr, where, ranges);
 
     Identifier table_name = statement->tableName;
     DbRelation &table = tables->get_table(table_name);
     EvalPlan *relation = new EvalPlan(table);
 
     EvalPlan *plan = relation;
-    if (!where.empty())
-        plan = new EvalPlan(&where, relation);
+    if (!where.empty() || !ranges.empty())
+        plan = new EvalPlan(&where, &ranges, relation);
 
-    EvalPlan *optimized = plan->optimize();
+    EvalPlan *optimized = plan->optimize(SQLExec::indices);
     Handles *handles = optimized->pipeline().second;
     delete optimized;
+
+    // remove each row from every index (reading the row once for all of them), then from the table
     IndexNames index_names = SQLExec::indices->get_index_names(table_name);
-    vector<CreateStatement *> create_statements;
-    try {
-        for (Identifier index_name : index_names) {
-            ColumnNames index_columns;
-            bool is_unique = false, is_hash = false;
-            SQLExec::indices->get_columns(table_name, index_name, index_columns, is_hash, is_unique);
-            
-            auto create_statement = new CreateStatement(CreateStatement::CreateType::kIndex);
-            create_statement->tableName = (char *)(table_name.c_str());
-            create_statement->indexName = (char *)(index_name.c_str());
-            create_statement->indexType = (char *)(is_hash ? "HASH" : "BTREE");
-            create_statement->indexColumns = new vector<char *>();
-            for (auto col_name : index_columns)
-                create_statement->indexColumns->push_back((char *) col_name.c_str());
-            create_statements.push_back(create_statement);
-            
-            auto drop_statement = new DropStatement(DropStatement::EntityType::kIndex);
-            drop_statement->name = (char *)(table_name.c_str());
-            drop_statement->indexName = (char *)(index_name.c_str());
-            delete drop_index(drop_statement);
+    for (Handle &handle : *handles) {
+        if (!index_names.empty()) {
+            ValueDict *row = table.project(handle);
+            try {
+                for (Identifier &index_name : index_names) {
+                    DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+                    index.del(handle, row);
+                }
+            } catch (...) {
+                delete row;
+                delete handles;
+                throw;
+            }
+            delete row;
         }
-
-        for (Handle &handle : *handles)
-            table.del(handle);
-
-        for (auto create_statement : create_statements) 
-            create_index(create_statement);
-
-    } catch (exception &e) {
-        // TODO: rollback
-        throw;
+        table.del(handle);
     }
-  
+
     string message = "successfully deleted " + to_string(handles->size()) +
                      " rows from " + table_name;
     if (index_names.size() > 0)
@@ -260,10 +362,11 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
 
     // enclose that in a Select if we have a where clause
     ValueDict where;
+    ValueRanges ranges;
     if (statement->whereClause != nullptr) {
         DEBUG_OUT("SQLExec::select() - Select\n");
-        parse_expr(statement->whereClause, where);
-        plan = new EvalPlan(&where, plan);
+        parse_expr(statement->whereClause, where, ranges);
+        plan = new EvalPlan(&where, &ranges, plan);
     } else {
         DEBUG_OUT("SQLExec::select() - NO Select\n");
     }
@@ -287,18 +390,47 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
         throw SQLExecError("NULL selectList");
     }
 
-    // optimize the plan and evaluate the optimized plan
-    DEBUG_OUT("SQLExec::select() - Optimize and Evaluate\n");
-    EvalPlan *optimized = plan->optimize();
-    ValueDicts *rows = optimized->evaluate();
+    // and cut it off with a Limit if asked to
+    if (statement->limit != nullptr) {
+        DEBUG_OUT("SQLExec::select() - Limit\n");
+        u_long limit = statement->limit->limit == kNoLimit ? ULONG_MAX : (u_long) statement->limit->limit;
+        u_long offset = statement->limit->offset == kNoOffset ? 0 : (u_long) statement->limit->offset;
+        plan = new EvalPlan(limit, offset, plan);
+    }
+
+    // optimize the plan and compile the optimized plan into operators (vectorized if we can); the rows are pulled
+    // as they are printed
+    DEBUG_OUT("SQLExec::select() - Optimize and Compile\n");
+    EvalPlan *optimized = plan->optimize(SQLExec::indices);
+    QueryArena *arena = new QueryArena();
+    RowOperator *rows = nullptr;
+    try {
+        if (SQLExec::vectorized)
+            rows = optimized->vectorize(ThreadPool::instance().get_thread_count(), arena);
+        if (rows == nullptr)
+            rows = optimized->compile(arena);
+    } catch (...) {
+        delete optimized;
+        delete projection;
+        delete arena;
+        throw;
+    }
     delete optimized;
+    try {
+        rows->open();
+    } catch (...) {
+        delete rows;
+        delete projection;
+        delete arena;
+        throw;
+    }
 
     // get applicable column names and attributes for final result
     // ColumnNames *column_names = 
     ColumnAttributes *column_attributes = new ColumnAttributes(table.get_column_attributes());
 
     DEBUG_OUT("SQLExec::select() - end\n");
-    return new QueryResult(projection, column_attributes, rows, "successfully returned " + to_string(rows->size()) + " rows");
+    return new QueryResult(projection, column_attributes, rows, arena);
 }
 
 void SQLExec::column_definition(const ColumnDefinition *col,
@@ -408,8 +540,8 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
     row[TABLE_NAME] = Value(table_name);
     row[INDEX_NAME] = Value(index_name);
     row[INDEX_TYPE] = Value(statement->indexType);
-    row[IS_UNIQUE] = Value(string(statement->indexType) ==
-                           "BTREE"); // assume HASH is non-unique --
+    // BTREE is unique; BTREE_MULTI is a B-tree that takes duplicate keys (and assume HASH is non-unique)
+    row[IS_UNIQUE] = Value(string(statement->indexType) == "BTREE");
     int seq = 0;
     Handles i_handles;
     try {
@@ -420,6 +552,9 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         }
 
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+        BTreeIndex *btree = dynamic_cast<BTreeIndex *>(&index);
+        if (btree != nullptr)
+            btree->set_fill_factor(SQLExec::index_fill_factor);
         index.create();
 
     } catch (...) {
@@ -48,6 +48,47 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
     return out;
 }
 
+void ValueRange::restrict_min(const Value &value, bool inclusive) {
+    if (!this->has_min || this->min < value || (value == this->min && !inclusive)) {
+        this->has_min = true;
+        this->min = value;
+        this->min_inclusive = inclusive;
+    }
+}
+
+void ValueRange::restrict_max(const Value &value, bool inclusive) {
+    if (!this->has_max || value < this->max || (value == this->max && !inclusive)) {
+        this->has_max = true;
+        this->max = value;
+        this->max_inclusive = inclusive;
+    }
+}
+
+bool ValueRange::contains(const Value &value) const {
+    if (this->has_min && (value < this->min || (!this->min_inclusive && value == this->min)))
+        return false;
+    if (this->has_max && (this->max < value || (!this->max_inclusive && value == this->max)))
+        return false;
+    return true;
+}
+
+// Same as contains(Value(std::string(text, size))). A bound of another type is before any TEXT value.
+bool ValueRange::contains_text(const char *text, size_t size) const {
+    if (this->has_min) {
+        int cmp = this->min.data_type == ColumnAttribute::TEXT ? -this->min.s.compare(0, std::string::npos, text, size)
+                                                               : 1;
+        if (cmp < 0 || (cmp == 0 && !this->min_inclusive))
+            return false;
+    }
+    if (this->has_max) {
+        int cmp = this->max.data_type == ColumnAttribute::TEXT ? -this->max.s.compare(0, std::string::npos, text, size)
+                                                               : 1;
+        if (cmp > 0 || (cmp == 0 && !this->max_inclusive))
+            return false;
+    }
+    return true;
+}
+
 // Get only selected column attributes
 ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -71,12 +112,9 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     return this->project(handle, &t);
 }
 
-// Do a projection for each of a list of handles
+// Do a projection of all the columns for each of a list of handles
 ValueDicts *DbRelation::project(Handles *handles) {
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle));
-    return ret;
+    return project(handles, &this->column_names);
 }
 
 // Do a projection for each of a list of handles
@@ -87,14 +125,182 @@ ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_name
     return ret;
 }
 
-// Do a projection for each of a list of handles
+// Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
     ColumnNames t;
     for (auto const &column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, &t));
+    return project(handles, &t);
+}
+
+// Project each handle as a ValueDict and line up its values in column_names order.
+Rows *DbRelation::project_rows(Handles *handles, const ColumnNames *column_names, QueryArena *arena) {
+    Rows *ret = new Rows();
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle, column_names);
+        Row *values = new Row(ArenaAllocator<Value>(arena));
+        for (auto const &column_name: *column_names)
+            values->push_back(row->at(column_name));
+        delete row;
+        ret->push_back(values);
+    }
+    return ret;
+}
+
+ValueDict *to_value_dict(const ColumnNames &column_names, const Row &row) {
+    ValueDict *ret = new ValueDict();
+    for (uint i = 0; i < column_names.size(); i++)
+        (*ret)[column_names[i]] = row[i];
     return ret;
 }
 
+// Equality selection, then filter on ranges.
+Handles *DbRelation::select(const ValueDict *where, const ValueRanges *ranges) {
+    return in_ranges(select(where), ranges);
+}
+
+// Equality refinement, then filter on ranges.
+Handles *DbRelation::select(Handles *current_selection, const ValueDict *where, const ValueRanges *ranges) {
+    return in_ranges(select(current_selection, where), ranges);
+}
+
+/**
+ * @class BlockIDsIterator - walks a materialized list of block ids
+ */
+class BlockIDsIterator : public BlockIterator {
+  public:
+    BlockIDsIterator(BlockIDs *block_ids) : block_ids(block_ids), i(0) {}
+
+    virtual ~BlockIDsIterator() { delete block_ids; }
+
+    virtual bool next(BlockID &block_id) {
+        if (i >= block_ids->size())
+            return false;
+        block_id = (*block_ids)[i++];
+        return true;
+    }
+
+  protected:
+    BlockIDs *block_ids;
+    u_long i;
+};
+
+/**
+ * @class HandlesIterator - walks a materialized list of handles
+ */
+class HandlesIterator : public HandleIterator {
+  public:
+    HandlesIterator(Handles *handles) : handles(handles), i(0) {}
+
+    virtual ~HandlesIterator() { delete handles; }
+
+    virtual bool next(Handle &handle) {
+        if (i >= handles->size())
+            return false;
+        handle = (*handles)[i++];
+        return true;
+    }
+
+  protected:
+    Handles *handles;
+    u_long i;
+};
+
+/**
+ * @class ProjectingIterator - projects each handle from another iterator
+ */
+class ProjectingIterator : public RowIterator {
+  public:
+    ProjectingIterator(DbRelation &relation, const ColumnNames *column_names, HandleIterator *handles,
+                       QueryArena *arena) : relation(relation), column_names(*column_names), handles(handles),
+                                            arena(arena) {}
+
+    virtual ~ProjectingIterator() { delete handles; }
+
+    virtual bool next(Row *&row) {
+        Handle handle;
+        if (!handles->next(handle))
+            return false;
+        ValueDict *values = relation.project(handle, &column_names);
+        row = new Row(ArenaAllocator<Value>(arena));
+        for (auto const &column_name: column_names)
+            row->push_back(values->at(column_name));
+        delete values;
+        return true;
+    }
+
+  protected:
+    DbRelation &relation;
+    ColumnNames column_names;
+    HandleIterator *handles;
+    QueryArena *arena;
+};
+
+// Walk the list from block_ids().
+BlockIterator *DbFile::blocks() const {
+    return new BlockIDsIterator(block_ids());
+}
+
+// Walk the list from select().
+HandleIterator *DbRelation::scan(const ValueDict *where, const ValueRanges *ranges) {
+    return new HandlesIterator(select(where, ranges));
+}
+
+// Project each handle from scan().
+RowIterator *DbRelation::rows(const ColumnNames *column_names, const ValueDict *where, const ValueRanges *ranges,
+                              QueryArena *arena) {
+    return new ProjectingIterator(*this, column_names, scan(where, ranges), arena);
+}
+
+// Keep only those handles whose rows are within all the ranges (takes ownership of handles).
+Handles *DbRelation::in_ranges(Handles *handles, const ValueRanges *ranges) {
+    if (ranges == nullptr || ranges->empty())
+        return handles;
+    ColumnNames t;
+    for (auto const &column: *ranges)
+        t.push_back(column.first);
+    Handles *ret = new Handles();
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle, &t);
+        bool in_range = true;
+        for (auto const &column: *ranges)
+            if (!column.second.contains(row->at(column.first))) {
+                in_range = false;
+                break;
+            }
+        delete row;
+        if (in_range)
+            ret->push_back(handle);
+    }
+    delete handles;
+    return ret;
+}
+
+bool DbIndex::contains(ValueDict *key_values) const {
+    Handles *handles = lookup(key_values);
+    bool found = !handles->empty();
+    delete handles;
+    return found;
+}
+
+void DbIndex::insert(Handle record) {
+    ValueDict *row = relation.project(record, &key_columns);
+    try {
+        insert(record, row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+}
+
+void DbIndex::del(Handle record) {
+    ValueDict *row = relation.project(record, &key_columns);
+    try {
+        del(record, row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file thread_pool.cpp - implementation of ThreadPool
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include "thread_pool.h"
+
+using namespace std;
+
+/**
+ * The thread pool shared by all the queries.
+ * @return the pool
+ */
+ThreadPool &ThreadPool::instance() {
+    static ThreadPool pool(thread::hardware_concurrency());
+    return pool;
+}
+
+/**
+ * Constructor
+ * @param thread_count  number of workers (0 is taken as 1)
+ */
+ThreadPool::ThreadPool(uint thread_count) : workers(), tasks(), lock(), wakeup(), stopping(false) {
+    start(thread_count);
+}
+
+/**
+ * Destructor. Finishes the queued tasks, then joins the workers.
+ */
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> guard(this->lock);
+        this->tasks.push_back(task);
+    }
+    this->wakeup.notify_one();
+}
+
+void ThreadPool::set_thread_count(uint thread_count) {
+    stop();
+    start(thread_count);
+}
+
+void ThreadPool::start(uint thread_count) {
+    this->stopping = false;
+    for (uint i = 0; i < max(thread_count, 1U); i++)
+        this->workers.push_back(thread(&ThreadPool::work, this));
+}
+
+void ThreadPool::stop() {
+    {
+        lock_guard<mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wakeup.notify_all();
+    for (auto &worker: this->workers)
+        worker.join();
+    this->workers.clear();
+}
+
+// Each worker's loop: run tasks until told to stop and there are none left.
+void ThreadPool::work() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(this->lock);
+            this->wakeup.wait(guard, [this] { return this->stopping || !this->tasks.empty(); });
+            if (this->tasks.empty())
+                return;
+            task = this->tasks.front();
+            this->tasks.pop_front();
+        }
+        task();
+    }
+}